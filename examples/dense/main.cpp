@@ -17,6 +17,9 @@
 #include "tess/tess.h"
 #include "tess/tess.hpp"
 #include "tess/dense.hpp"
+#ifndef TESS_NO_OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -34,8 +37,14 @@ void ParseArgs(int argc,
     assert(argc >= 10);
     if (atoi(argv[3]) == 0)
         alg_type = DENSE_TESS;
-    else
+    else if (atoi(argv[3]) == 1)
         alg_type = DENSE_CIC;
+    else if (atoi(argv[3]) == 2)
+        alg_type = DENSE_DTFE;
+    else if (atoi(argv[3]) == 3)
+        alg_type = DENSE_TSC;
+    else
+        alg_type = DENSE_PCS;
     glo_num_idx[0] = atoi(argv[4]);
     glo_num_idx[1] = atoi(argv[5]);
     glo_num_idx[2] = atoi(argv[6]);
@@ -105,7 +114,7 @@ int main(int argc, char** argv)
     float eps = 0.0001;                         // epsilon for floating point values to be equal
     float data_mins[3], data_maxs[3];           // data global bounds
     float mass;                                 // particle mass
-    alg alg_type;                               // tess or cic
+    alg alg_type;                               // estimator algorithm
 
     // grid bounds
     int num_given_bounds;                       // number of given bounds
@@ -166,10 +175,19 @@ int main(int argc, char** argv)
     MPI_Allreduce(&nblocks, &maxblocks, 1, MPI_INT, MPI_MAX, comm);
     MPI_Allreduce(&nblocks, &tot_blocks, 1, MPI_INT, MPI_SUM, comm);
 
+    // threads estimating the density of each block (OMP_NUM_THREADS)
+    int dense_threads = 1;
+#ifndef TESS_NO_OPENMP
+    dense_threads = omp_get_max_threads();
+#endif
+
+    // grids of more than 1024^3 points are stored in tiles, allocated where there is density
+    bool tiled = (double)glo_num_idx[0] * glo_num_idx[1] * glo_num_idx[2] > 1024.0 * 1024.0 * 1024.0;
+
     // compute the density
     dense(alg_type, num_given_bounds, given_mins, given_maxs, project, proj_plane,
           mass, data_mins, data_maxs, grid_phys_mins, grid_phys_maxs, grid_step_size, eps,
-          glo_num_idx, master);
+          glo_num_idx, master, dense_threads, tiled);
 
     MPI_Barrier(comm);
     times[COMP_TIME] = MPI_Wtime() - times[COMP_TIME];
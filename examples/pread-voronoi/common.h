@@ -95,9 +95,7 @@ void enumerate_cells(DBlock* b,
       int t = b->vert_to_tet[p];
       if (t < 0)
 	fprintf(stderr, "[%d] Warning: no matching tet for point %ld\n", cp.gid(), p);
-      vector< pair<int, int> > nbrs;
-      bool finite = neighbor_edges(nbrs, p, b->tets, t);
-      if (!finite)
+      if (!CELL_COMPLETE(b, p))
 	++infinite;
     }
     //fprintf(stderr, "[%d] %lu infinite Voronoi cells\n", cp.gid(), infinite);
@@ -91,6 +91,7 @@ int main(int argc, char *argv[])
 {
     int tot_blocks; // total number of blocks in the domain
     int num_threads; // number of threads diy can use
+    int local_threads; // number of threads for the triangulation of one block
     int mem_blocks; // number of blocks to keep in memory
     string infile; // input file name
     string outfile; // output file name
@@ -115,6 +116,7 @@ int main(int argc, char *argv[])
     // defaults
     tot_blocks    = size;
     num_threads   = 4;
+    local_threads = 1;
     mem_blocks    = -1;
     string prefix = "./DIY.XXXXXX";
     minvol        = 0;
@@ -125,6 +127,7 @@ int main(int argc, char *argv[])
     ops
         >> Option('b', "blocks",    tot_blocks,   "Total number of blocks to use")
         >> Option('t', "threads",   num_threads,  "Number of threads to use")
+        >> Option(     "local-threads", local_threads, "Number of threads for the triangulation of a block")
         >> Option('m', "in-memory", mem_blocks,   "Number of blocks to keep in memory")
         >> Option('s', "storage",   prefix,       "Path for out-of-core storage")
         >> Option(     "minvol",    minvol,       "minvol cutoff")
@@ -132,6 +135,10 @@ int main(int argc, char *argv[])
         ;
     wrap_ = ops >> Present('w', "wrap", "Use periodic boundary conditions");
     bool kdtree = ops >> Present(     "kdtree", "use kdtree decomposition");
+    bool predictive = ops >> Present( "predictive", "ship a predicted ghost shell in the first round");
+    bool async = ops >> Present(      "async", "overlap the exchange with the local triangulation");
+    bool counting = ops >> Present(   "counting", "detect termination by counting messages");
+    bool reorder = ops >> Present(    "reorder", "sort the particles and tets of a block along a Morton curve");
 
     coordinates.resize(3);
     if (  ops >> Present('h', "help", "show help") ||
@@ -211,7 +218,10 @@ int main(int argc, char *argv[])
     // debug purposes only: checks if the particles got into the right blocks
     // master.foreach(&verify_particles);
 
-    size_t rounds = tess(master, quants, times);
+    size_t rounds = tess(master, quants, times, predictive,
+                         async    ? TESS_ROUNDS_ASYNC    :
+                         counting ? TESS_ROUNDS_COUNTING : TESS_ROUNDS_SYNC,
+                         local_threads, reorder);
     if (rank == 0)
       fprintf(stderr, "Done in %lu rounds\n", rounds);
 
@@ -32,8 +32,14 @@ void GetArgs(int argc,
 
   if (atoi(argv[1]) == 0)
     alg_type = DENSE_TESS;
-  else
+  else if (atoi(argv[1]) == 1)
     alg_type = DENSE_CIC;
+  else if (atoi(argv[1]) == 2)
+    alg_type = DENSE_DTFE;
+  else if (atoi(argv[1]) == 3)
+    alg_type = DENSE_TSC;
+  else
+    alg_type = DENSE_PCS;
   tb = atoi(argv[2]);
   dsize[0] = atoi(argv[3]);
   dsize[1] = atoi(argv[4]);
@@ -123,7 +129,7 @@ int main(int argc, char *argv[])
   float eps = 0.0001;                         // epsilon for floating point values to be equal
   float data_mins[3], data_maxs[3];           // data global bounds
   MPI_Comm comm = MPI_COMM_WORLD;
-  alg alg_type;                               // TESS or CIC
+  alg alg_type;                               // estimator algorithm
 
   // grid bounds
   int num_given_bounds;                       // number of given bounds
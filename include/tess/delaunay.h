@@ -17,6 +17,11 @@
 
 #define MAX_HIST_BINS 256      /* maximum number of bins in cell volume histogram */
 #define MAX_NEIGHBORS 27       /* maximum number of neighbor blocks */
+#define DENSE_TILE 16          /* grid points along each side of a density tile */
+#define DENSE_TILE_PTS (DENSE_TILE * DENSE_TILE * DENSE_TILE)
+
+/* whether the Voronoi cell of particle v of block b is complete (finite) */
+#define CELL_COMPLETE(b, v) (((b)->complete_cells[(v) >> 3] >> ((v) & 7)) & 1)
 
 /* remote particle */
 struct point_t {
@@ -54,10 +59,33 @@ struct dblock_t {
     int* rem_gids;             /* owners of remote particles */
     int* rem_lids;	       /* "local ids" of the remote particles */
     int* vert_to_tet;          /* a tet that contains the vertex */
+    int num_changed_tets;      /* number of tets created or modified by the last
+                                  local_cells(); -1 if all tets are new */
+    int* changed_tets;         /* indices of the created or modified tets */
+    unsigned char* complete_cells; /* bitmap of the particles with complete Voronoi cells,
+                                      see fill_complete_cells() and CELL_COMPLETE() */
+    int* orig_ids;             /* input order of the original particles after they were
+                                  reordered (see reorder_particles()), NULL if they were not;
+                                  rem_lids are in the input order of their owners */
+    int* adj_offsets;          /* Voronoi neighbors of the original particles in CSR form (see
+                                  fill_adjacency()), NULL if not built: the neighbors of
+                                  particle v are entries adj_offsets[v] to adj_offsets[v + 1] - 1 */
+    int* adj_gids;             /* neighbor owner; gid for the original particles of this block */
+    int* adj_lids;             /* neighbor index in the input order (orig_ids) if local,
+                                  rem_lid if a ghost */
+
+    /* allocated sizes, kept across rounds (see reserve_particles(), reserve_tets()) */
+    int max_particles;         /* particles; rem_gids, rem_lids hold the ghosts of these */
+    int max_tets;              /* tets */
+    int max_vert_to_tet;       /* vert_to_tet */
 
     /* estimated density field */
-    float* density;            /* density field */
+    float* density;            /* density field, NULL if it is tiled */
     int num_grid_pts;          /* total number of density grid points */
+    float** density_tiles;     /* tiled density field, NULL if it is not: tiles of DENSE_TILE^3
+                                  grid points in x-fastest order, the tiles too; a tile is NULL
+                                  until a density is assigned in it (see init_dense()) */
+    int num_density_tiles;     /* number of tiles, 0 if the density field is not tiled */
 
     int complete;
 };
@@ -13,13 +13,37 @@
 #ifndef _DELAUNAY_HPP
 #define _DELAUNAY_HPP
 
+#include <vector>
 #include <diy/types.hpp>
+#include "tet.hpp"
+#include "tet-neighbors.h"
+
+// flags in DBlock::settled
+enum
+{
+    TET_SETTLED = 1,                                 // tet can no longer send particles
+    TET_LISTED  = 2,                                 // tet is in DBlock::unsettled
+};
 
 struct DBlock : dblock_t
 {
     diy::ContinuousBounds bounds;                    // local block extents
     diy::ContinuousBounds data_bounds;               // global data extents
     diy::ContinuousBounds box;                       // box in current round of point redistribution
+
+    // persistent across the rounds of tess(), indexed by tet
+    circumspheres_t            spheres;              // cached circumspheres (see update_spheres())
+    bool                       spheres_current;      // spheres match the tets; cleared by reset_block()
+    std::vector<unsigned char> settled;              // TET_SETTLED, TET_LISTED flags
+    std::vector<int>           unsettled;            // tets that may still send particles
+
+    // optional, built after the tessellation for the analysis (see fill_vert_stars())
+    vert_stars_t               stars;                // tets around each vertex
+    std::vector<unsigned char> mirrors;              // mirror faces of the tets (see fill_mirrors())
+
+    // link neighbors in the last round of tess(), which include the owners of all the ghost
+    // particles, also those that are not neighbors in the original link (see dtfe_rho())
+    std::vector<diy::BlockID>  round_neighbors;
 };
 
 #endif
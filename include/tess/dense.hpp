@@ -29,11 +29,24 @@
 
 using namespace std;
 
+// original particles whose Voronoi cells IterateCells() and IterateCellsOMP() hold at a time
+#define DENSE_CELL_CHUNK 65536
+
+// particles whose mass assignment weights IterateParticlesMas() computes together
+#define DENSE_MAS_BATCH 256
+
+// DENSE_DTFE density of a ghost particle whose owner sent none (see recv_ghost_rho());
+// -1 is an incomplete cell
+#define DENSE_NO_RHO -2.0
+
 // estimator algorithm
 enum alg
 {
     DENSE_TESS,
     DENSE_CIC,
+    DENSE_DTFE,
+    DENSE_TSC,
+    DENSE_PCS,
     DENSE_NUM_ALGS,
 };
 
@@ -44,6 +57,18 @@ struct grid_pt_t
     double mass; // mass
 };
 
+// DENSE_DTFE: grid points of a block that have a value, one vector per density tile
+// (see init_dense()), empty for the tiles not written yet
+typedef vector< vector<unsigned char> > covered_t;
+
+// debug: consistency checks and output stats of one block
+struct dense_stats_t
+{
+    float  max_dense;                 // max density
+    double tot_mass;                  // total output mass
+    float  check_mass;                // ground truth total mass
+};
+
 // auxiliary arguments for foreach block functions
 struct args_t
 {
@@ -58,6 +83,14 @@ struct args_t
     float eps;
     int   glo_num_idx[3];
     float div;
+    int   num_threads;                // threads estimating the density of one block
+    bool  tiled;                      // density stored in tiles of DENSE_TILE^3 grid points
+    dense_stats_t* stats;             // stats of each block (by lid), merged after the foreach
+    covered_t* covered;               // DENSE_DTFE: grid points of each block (by lid) that
+                                      // have a value, so that received ones do not overwrite it
+    vector<float>* rho;               // DENSE_DTFE: densities at the particles of each block
+                                      // (by lid), the ghosts' from their owners, -1 for an
+                                      // incomplete cell, DENSE_NO_RHO if none was received
 };
 
 // timing
@@ -86,7 +119,9 @@ void dense(alg alg_type,
 	   float *grid_step_size,
            float eps,
            int *glo_num_idx,
-           diy::Master& master);
+           diy::Master& master,
+           int num_threads = 1,
+           bool tiled = false);
 void init_dense(DBlock*                         b,
                 const diy::Master::ProxyWithLink& cp,
                 args_t*                           a);
@@ -96,6 +131,19 @@ void est_dense(DBlock*                         b,
 void recvd_pts(DBlock*                         b,
                const diy::Master::ProxyWithLink& cp,
                args_t*                           a);
+void dtfe_rho(DBlock*                         b,
+              const diy::Master::ProxyWithLink& cp,
+              args_t*                           a);
+void send_ghost_rho(DBlock*                         b,
+                    const diy::Master::ProxyWithLink& cp,
+                    args_t*                           a);
+void recv_ghost_rho(DBlock*                         b,
+                    const diy::Master::ProxyWithLink& cp,
+                    args_t*                           a);
+void SendGridPts(DBlock*                         b,
+                 const diy::Master::ProxyWithLink& cp,
+                 args_t*                           a,
+                 vector<grid_pt_t>&                off_block);
 void BlockGridParams(DBlock *dblock,
                      int *block_min_idx,
                      int *block_max_idx,
@@ -106,6 +154,16 @@ void BlockGridParams(DBlock *dblock,
                      float *data_mins,
                      float *data_maxs,
                      int *glo_num_idx);
+void BlockGridParams(const diy::ContinuousBounds& bounds,
+                     int *block_min_idx,
+                     int *block_max_idx,
+                     int *block_num_idx,
+		     float *grid_phys_mins,
+                     float *grid_step_size,
+                     float eps,
+                     float *data_mins,
+                     float *data_maxs,
+                     int *glo_num_idx);
 void IterateCells(DBlock *dblock,
                   int *block_min_idx,
                   int *block_num_idx,
@@ -117,8 +175,8 @@ void IterateCells(DBlock *dblock,
                   float *data_maxs,
                   float eps,
                   float mass,
-                  const diy::Master::ProxyWithLink& cp);
-#ifndef TESS_NO_OPENMP
+                  vector<grid_pt_t>& off_block,
+                  dense_stats_t& stats);
 void IterateCellsOMP(DBlock *dblock,
                      int *block_min_idx,
                      int *block_num_idx,
@@ -130,8 +188,33 @@ void IterateCellsOMP(DBlock *dblock,
                      float *data_maxs,
                      float eps,
                      float mass,
-                     const diy::Master::ProxyWithLink& cp);
-#endif
+                     vector<grid_pt_t>& off_block,
+                     dense_stats_t& stats,
+                     int num_threads);
+void IterateTetsDtfe(DBlock *dblock,
+                     int *block_min_idx,
+                     int *block_num_idx,
+                     float *grid_phys_mins,
+                     float *grid_step_size,
+                     int *glo_num_idx,
+                     const vector<float>& rho,
+                     float div,
+                     vector<grid_pt_t>& off_block,
+                     dense_stats_t& stats,
+                     covered_t& covered,
+                     int num_threads);
+void IterateParticlesMas(DBlock *dblock,
+                         int order,
+                         int *block_min_idx,
+                         int *block_num_idx,
+                         bool project,
+                         float *proj_plane,
+                         float *grid_phys_mins,
+                         float *grid_step_size,
+                         float mass,
+                         vector<grid_pt_t>& off_block,
+                         dense_stats_t& stats,
+                         int num_threads);
 void IterateCellsCic(DBlock *dblock,
                      int *block_min_idx,
                      int *block_num_idx,
@@ -142,9 +225,11 @@ void IterateCellsCic(DBlock *dblock,
 		     float *data_maxs,
                      float eps,
                      float mass,
-                     const diy::Master::ProxyWithLink& cp);
-void CellBounds(DBlock *dblock,
-                int cell,
+                     vector<grid_pt_t>& off_block,
+                     dense_stats_t& stats);
+void CellBounds(const voronoi_mesh_t& mesh,
+                int c,
+                const circumspheres_t& spheres,
                 float *cell_min,
                 float *cell_max,
 		vector<float> &normals,
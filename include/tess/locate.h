@@ -0,0 +1,48 @@
+// C++ only header to use vector
+
+#ifndef _TESS_LOCATE_H
+#define _TESS_LOCATE_H
+
+#include <vector>
+#include "tet.h"
+#include "tet-neighbors.h"
+
+// coarse uniform grid over the particles that picks the tet a walk of locate() starts from
+struct locate_grid_t
+{
+    float            min[3];                         // grid origin
+    float            scale[3];                       // cells per unit length
+    int              dims[3];                        // cells per axis
+    std::vector<int> sites;                          // a site in or near each cell, -1 if none
+};
+
+void fill_locate_grid(locate_grid_t&    grid,
+                      float*            particles,
+                      int               num_particles,
+                      const int*        vert_to_tet);
+
+int locate_tet(const float*     q,
+               int              t,
+               tet_t*           tets,
+               int              num_tets,
+               float*           particles);
+
+int nearest_site(const float*           q,
+                 int                    v,
+                 tet_t*                 tets,
+                 const vert_stars_t&    stars,
+                 float*                 particles);
+
+void locate(int*                        tets_out,
+            int*                        sites_out,
+            const float*                queries,
+            int                         num_queries,
+            tet_t*                      tets,
+            int                         num_tets,
+            const int*                  vert_to_tet,
+            const vert_stars_t&         stars,
+            float*                      particles,
+            const locate_grid_t&        grid,
+            int                         num_threads = 1);
+
+#endif
@@ -11,7 +11,12 @@ typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
 
 typedef CGAL::Triangulation_vertex_base_with_info_3<unsigned, K>    Vb;
 typedef CGAL::Triangulation_cell_base_with_info_3<int, K>	    Cb;
+#ifdef TESS_CGAL_PARALLEL
+// parallel insertion (with TBB) into a triangulation guarded by a lock grid
+typedef CGAL::Triangulation_data_structure_3<Vb,Cb,CGAL::Parallel_tag> Tds;
+#else
 typedef CGAL::Triangulation_data_structure_3<Vb,Cb>                 Tds;
+#endif
 //Use the Fast_location tag. Default or Compact_location works too.
 //typedef CGAL::Delaunay_triangulation_3<K, Tds, CGAL::Fast_location> Delaunay3D;
 typedef CGAL::Delaunay_triangulation_3<K, Tds>	    Delaunay3D;
@@ -33,7 +38,8 @@ typedef Delaunay3D::Facet_circulator                Facet_circulator;
 int gen_voronoi_output(Delaunay3D &Dt, struct vblock_t *vblock,
 		       int num_particles);
 int gen_delaunay_output(Delaunay3D &Dt, int **tet_verts);
-void construct_delaunay(Delaunay3D &Dt, int num_particles, float *particles);
+void construct_delaunay(Delaunay3D &Dt, int num_particles, float *particles,
+                        int num_threads = 1);
 
 void gen_tets(Delaunay3D& Dt, tet_t* tets);
 
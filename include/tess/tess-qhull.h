@@ -3,6 +3,23 @@
 #include "tet.h"
 #include "delaunay.h"
 
+/* persistent qhull state kept in dblock->Dt between rounds, so that later
+   rounds only retriangulate the region affected by the received particles */
+struct qhull_dt_t {
+  int num_particles;           /* particles already in the triangulation */
+  int num_tets;                /* number of tets in the triangulation */
+  int max_tets;                /* allocated size of the per-tet arrays */
+  int max_verts;               /* allocated size of the per-vertex arrays */
+  struct tet_t* tets;          /* the triangulation */
+  int* vert_to_tet;            /* a tet that contains the vertex */
+  unsigned char* flags;        /* per-tet conflict and visible hull face bits */
+  unsigned char* hull_seen;    /* per-tet visited hull faces, valid for hull_stamp */
+  int* stamp;                  /* per-tet visit stamp */
+  int* hull_stamp;             /* per-tet stamp for hull_seen */
+  int* vert_stamp;             /* per-vertex stamp */
+  int cur_stamp;               /* current stamp */
+};
+
 void gen_delaunay_output(facetT *facetlist, struct dblock_t *dblock);
-void reorder_neighbors(struct dblock_t *dblock);
+void reorder_neighbors(struct dblock_t *dblock, int num_threads);
 
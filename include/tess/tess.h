@@ -41,7 +41,7 @@ enum
 #ifdef __cplusplus
 extern "C"
 #endif
-void local_cells(struct dblock_t *b);
+void local_cells(struct dblock_t *b, int num_threads);
 
 #ifdef __cplusplus
 extern "C"
@@ -65,6 +65,24 @@ extern "C"
 #endif
 void fill_vert_to_tet(struct dblock_t *dblock);
 
+#ifdef __cplusplus
+extern "C"
+#endif
+void fill_complete_cells(struct dblock_t *dblock);
+
+#ifdef __cplusplus
+extern "C"
+#endif
+void reserve_particles(struct dblock_t *dblock, int n);
+#ifdef __cplusplus
+extern "C"
+#endif
+void reserve_tets(struct dblock_t *dblock, int n);
+#ifdef __cplusplus
+extern "C"
+#endif
+void reserve_vert_to_tet(struct dblock_t *dblock, int n);
+
 #ifdef __cplusplus
 extern "C"
 #endif
@@ -36,6 +36,7 @@
 
 #include "tess.h"
 #include "delaunay.hpp"
+#include "voronoi.h"
 
 using namespace std;
 
@@ -47,14 +48,57 @@ struct quants_t
     int sum_quants[MAX_QUANTS];       // sum of quantities
 };
 
+// how tess() runs its rounds
+enum tess_rounds
+{
+    TESS_ROUNDS_SYNC,                 // exchange and all_reduce after every round
+    TESS_ROUNDS_ASYNC,                // pipelined rounds with iexchange (requires TESS_ASYNC)
+    TESS_ROUNDS_COUNTING,             // rounds end by counting sent and received messages
+};
+
 typedef diy::RegularContinuousLink  RCLink;
 typedef vector<RCLink>              LinkVector;
 typedef vector<size_t>              LastNeighbors;
 
-size_t tess(diy::Master& master);
+// records in an asynchronous round message
+enum
+{
+    TESS_MSG_LINK,                    // original link of the sender
+    TESS_MSG_PARTICLES,               // packed batch of particles
+};
+
+// per-block state of the asynchronous rounds
+struct AsyncState
+{
+    AsyncState() : started(false), last_sent(0), invocations(0)   {}
+
+    bool                            started;        // local cells computed at least once
+    size_t                          last_sent;      // link neighbors that have our link
+    size_t                          invocations;    // times the block was processed
+    vector< pair<int, RCLink> >     pending;        // links from senders not yet in our link
+};
+
+// answer of locate() for one query position
+struct locate_t
+{
+    int         gid;                  // block that located the position, -1 if none contains it
+    int         tet;                  // containing tet in that block, -1 outside its convex hull
+    int         site_gid;             // owner of the nearest site
+    int         site_lid;             // input-order index of the nearest site in its owner
+};
+
+size_t tess(diy::Master& master,
+            bool predictive = false,
+            tess_rounds mode = TESS_ROUNDS_SYNC,
+            int num_threads = 1,
+            bool reorder = false);
 size_t tess(diy::Master& master,
             quants_t& quants,
-            double* times);
+            double* times,
+            bool predictive = false,
+            tess_rounds mode = TESS_ROUNDS_SYNC,
+            int num_threads = 1,
+            bool reorder = false);
 void tess_exchange(diy::Master& master,
                    const diy::Assigner& assigner);
 void tess_exchange(diy::Master& master,
@@ -106,18 +150,66 @@ void delaunay(DBlock*                           b,
               const diy::Master::ProxyWithLink& cp,
               const LinkVector&                 links,
               LastNeighbors&                    neighbors,
-              bool                              first);
+              bool                              first,
+              bool                              predictive = false,
+              size_t*                           counts = NULL,
+              int                               num_threads = 1);
+#ifdef TESS_ASYNC
+bool delaunay_async(DBlock*                           b,
+                    const diy::Master::ProxyWithLink& cp,
+                    const LinkVector&                 links,
+                    AsyncState&                       state,
+                    bool                              predictive = false,
+                    int                               num_threads = 1);
+#endif
 void finalize(DBlock*                           b,
               const diy::Master::ProxyWithLink& cp,
-              quants_t&                         quants);
+              quants_t&                         quants,
+              bool                              reorder = false);
 void neighbor_particles(DBlock* b,
                         const diy::Master::ProxyWithLink& cp);
 size_t incomplete_cells(struct DBlock *dblock,
                         const diy::Master::ProxyWithLink& cp,
-                        size_t last_neighbor);
+                        size_t last_neighbor,
+                        bool predict = false,
+                        bool tagged = false);
 void reset_block(struct DBlock* &dblock);
+void reorder_particles(DBlock* dblock);
+void fill_edges(std::vector<int>& edges,
+                DBlock*           dblock,
+                int               num_threads = 1);
+void fill_adjacency(DBlock* dblock,
+                    int     num_threads = 1);
+void free_adjacency(dblock_t* dblock);
+void save_density(diy::BinaryBuffer& bb,
+                  const dblock_t&    dblock);
+void load_density(diy::BinaryBuffer& bb,
+                  dblock_t&          dblock);
+void free_density(dblock_t* dblock);
+void locate(DBlock*      dblock,
+            const float* queries,
+            int          num_queries,
+            int*         tets,
+            int*         sites,
+            int          num_threads = 1);
+void locate(diy::Master&                             master,
+            const std::vector< std::vector<float> >& queries,
+            std::vector< std::vector<locate_t> >&    results,
+            int                                      num_threads = 1);
 void fill_vert_to_tet(DBlock* dblock);
 void fill_vert_to_tet(dblock_t* dblock);
+void update_spheres(DBlock* dblock);
+void fill_voronoi_mesh(voronoi_mesh_t& mesh,
+                       DBlock*         dblock,
+                       bool            normals = false,
+                       int             num_threads = 1,
+                       int             first_site = 0,
+                       int             last_site = -1);
+void fill_volumes(DBlock* dblock,
+                  float*  volumes,
+                  float*  areas = NULL,
+                  float*  centroids = NULL,
+                  int     num_threads = 1);
 void wall_particles(struct DBlock *dblock);
 void sample_particles(float *particles,
                       int &num_particles,
@@ -159,8 +251,20 @@ struct AddBlock
             b->rem_gids = NULL;
             b->rem_lids = NULL;
             b->vert_to_tet = NULL;
+            b->num_changed_tets = -1;
+            b->changed_tets = NULL;
+            b->max_particles = 0;
+            b->max_tets = 0;
+            b->max_vert_to_tet = 0;
+            b->complete_cells = NULL;
+            b->orig_ids = NULL;
+            b->adj_offsets = NULL;
+            b->adj_gids = NULL;
+            b->adj_lids = NULL;
             b->num_grid_pts = 0;
             b->density = NULL;
+            b->density_tiles = NULL;
+            b->num_density_tiles = 0;
 
             return b;
         }
@@ -227,8 +331,10 @@ namespace diy
                 diy::save(bb, d.particles, 3 * d.num_particles);
                 diy::save(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
                 diy::save(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
-                diy::save(bb, d.num_grid_pts);
-                diy::save(bb, d.density, d.num_grid_pts);
+                save_density(bb, d);
+                int num_ids = d.orig_ids ? d.num_orig_particles : 0;
+                diy::save(bb, num_ids);
+                diy::save(bb, d.orig_ids, num_ids);
                 // NB tets and vert_to_tet get recreated in each phase; not saved and reloaded
 
                 diy::save(bb, d.complete);
@@ -249,6 +355,15 @@ namespace diy
                     diy::save(bb, d.num_tets);
                     diy::save(bb, d.tets, d.num_tets);
                     diy::save(bb, d.vert_to_tet, d.num_particles);
+                    diy::save(bb, d.complete_cells, (d.num_particles + 7) / 8);
+
+                    int num_offsets = d.adj_offsets ? d.num_orig_particles + 1 : 0;
+                    int num_adj     = d.adj_offsets ? d.adj_offsets[d.num_orig_particles] : 0;
+                    diy::save(bb, num_offsets);
+                    diy::save(bb, num_adj);
+                    diy::save(bb, d.adj_offsets, num_offsets);
+                    diy::save(bb, d.adj_gids, num_adj);
+                    diy::save(bb, d.adj_lids, num_adj);
                 }
 
                 // debug
@@ -280,15 +395,24 @@ namespace diy
                 }
                 diy::load(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
                 diy::load(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
-                diy::load(bb, d.num_grid_pts);
-                d.density = (float*)malloc(d.num_grid_pts * sizeof(float));
-                diy::load(bb, d.density, d.num_grid_pts);
+                load_density(bb, d);
+                int num_ids;
+                diy::load(bb, num_ids);
+                d.orig_ids = NULL;
+                if (num_ids)
+                    d.orig_ids = (int*)malloc(num_ids * sizeof(int));
+                diy::load(bb, d.orig_ids, num_ids);
                 // NB tets and vert_to_tet get recreated in each phase; not saved and reloaded
                 d.num_tets = 0;
                 d.tets = NULL;
                 d.vert_to_tet = NULL;
-                if (d.num_particles)
-                    d.vert_to_tet = (int*)malloc(d.num_particles * sizeof(int));
+                d.complete_cells = NULL;
+                d.adj_offsets = NULL;
+                d.adj_gids = NULL;
+                d.adj_lids = NULL;
+                d.max_particles = d.num_particles;
+                d.max_tets = 0;
+                d.max_vert_to_tet = 0;
 
                 diy::load(bb, d.complete);
 
@@ -308,10 +432,26 @@ namespace diy
                     diy::load(bb, d.num_tets);
                     d.tets = (tet_t*)malloc(d.num_tets * sizeof(tet_t));
                     diy::load(bb, d.tets, d.num_tets);
-                    d.vert_to_tet = NULL;
+                    d.max_tets = d.num_tets;
                     if (d.num_particles)
                         d.vert_to_tet = (int*)malloc(d.num_particles * sizeof(int));
+                    d.max_vert_to_tet = d.num_particles;
                     diy::load(bb, d.vert_to_tet, d.num_particles);
+                    d.complete_cells = (unsigned char*)malloc((d.num_particles + 7) / 8);
+                    diy::load(bb, d.complete_cells, (d.num_particles + 7) / 8);
+
+                    int num_offsets, num_adj;
+                    diy::load(bb, num_offsets);
+                    diy::load(bb, num_adj);
+                    if (num_offsets)
+                    {
+                        d.adj_offsets = (int*)malloc(num_offsets * sizeof(int));
+                        d.adj_gids = (int*)malloc(num_adj * sizeof(int));
+                        d.adj_lids = (int*)malloc(num_adj * sizeof(int));
+                    }
+                    diy::load(bb, d.adj_offsets, num_offsets);
+                    diy::load(bb, d.adj_gids, num_adj);
+                    diy::load(bb, d.adj_lids, num_adj);
                 }
 
                 // debug
@@ -1,6 +1,37 @@
 // C++ only header to use vector
 
+#ifndef _TESS_TET_NEIGHBORS_H
+#define _TESS_TET_NEIGHBORS_H
+
 #include <vector>
+#include <cstddef>
+#include "tet.h"
+
+// compressed (CSR) stars of the vertices: the tets that contain vertex v are
+// tets[offsets[v]], ..., tets[offsets[v + 1] - 1]
+struct vert_stars_t
+{
+    std::vector<int> offsets;
+    std::vector<int> tets;
+};
+
+void fill_vert_stars(vert_stars_t&      stars,
+                     tet_t*             tets,
+                     int                num_tets,
+                     int                num_verts);
+
+// versions of the queries below that scan the star of v instead of searching for it
+bool neighbor_edges(std::vector< std::pair<int, int> >& nbrs,
+                    int                 v,
+                    tet_t*              tets,
+                    const vert_stars_t& stars);
+bool neighbor_tets(std::vector<int>&    nbrs,
+                   int                  v,
+                   tet_t*               tets,
+                   const vert_stars_t&  stars);
+int complete(int                        v,
+             tet_t*                     tets,
+             const vert_stars_t&        stars);
 
 bool neighbor_edges(std::vector< std::pair<int, int> >& nbrs,
 		    int	    v,
@@ -25,8 +56,27 @@ int complete(int	    v,
 	      int	    t
 	     );
 
+// mirror faces of the tets, 2 bits per face in a byte per tet: face i of tet t (opposite
+// verts[i]) is face MIRROR(mirrors, t, i) of its neighbor tets[i]; 0 on the convex hull
+#define MIRROR(mirrors, t, i) (((mirrors)[t] >> (2 * (i))) & 3)
+
+void fill_mirrors(std::vector<unsigned char>&   mirrors,
+                  tet_t*                        tets,
+                  int                           num_tets,
+                  int                           num_threads = 1);
+
+// mirrors (see fill_mirrors()) are optional and save the vertex searches of the circulation
 void fill_edge_link(std::vector<int>&	edge_link,
 		    int			v,
 		    int			u,
 		    int			ut,
-		    tet_t*		tets);
+		    tet_t*		tets,
+		    const unsigned char* mirrors = NULL);
+
+// every Delaunay edge once, as pairs (u,v), u < v: edges[2*i], edges[2*i + 1]
+void fill_edges(std::vector<int>&       edges,
+                tet_t*                  tets,
+                int                     num_tets,
+                int                     num_threads = 1);
+
+#endif
@@ -1,9 +1,17 @@
 #ifndef _TESS_TET_HPP
 #define _TESS_TET_HPP
 
+#include <vector>
 #include "tess/tet.h"
 #include <diy/types.hpp>
 
+// circumspheres of the tets, structure of arrays indexed by tet
+struct circumspheres_t
+{
+    std::vector<float> x, y, z;                      // circumcenters
+    std::vector<float> r;                            // radii
+};
+
 int find(struct tet_t* tet,
          int v);
 float dot(float* u,
@@ -12,6 +20,16 @@ float dot(float* u,
 void circumcenter(float* c,
                   struct tet_t* tet,
                   float* particles);
+void fill_circumspheres(circumspheres_t& spheres,
+                        struct tet_t* tets,
+                        int num_tets,
+                        float* particles);
+void update_circumspheres(circumspheres_t& spheres,
+                          struct tet_t* tets,
+                          int num_tets,
+                          const int* changed,
+                          int num_changed,
+                          float* particles);
 int side_of_plane(diy::ContinuousBounds box,
                   struct tet_t* tet,
                   float* particles,
@@ -27,6 +45,14 @@ void circulate_next(int* next_t,
                     int v,
                     int x,
                     int y);
+void circulate_next(int* next_t,
+                    int* next_v,
+                    struct tet_t* tets,
+                    const unsigned char* mirrors,
+                    int t,
+                    int v,
+                    int x,
+                    int y);
 float distance(float* u,
                float* v);
 void cross(float* res,
@@ -3,16 +3,41 @@
 
 #include <vector>
 #include "tet.hpp"
-
-void fill_circumcenters(std::vector<float>& circumcenters,
-                        tet_t* tets,
-                        int num_tets,
-                        float* particles);
+#include "tet-neighbors.h"
+#include "voronoi.h"
 
 float volume(int v,
              int* verts_to_tets,
              tet_t* tets, int num_tets,
              float* particles,
-             const std::vector<float>& circumcenters);
+             const circumspheres_t& spheres);
+
+float volume(int v,
+             const vert_stars_t& stars,
+             tet_t* tets,
+             float* particles,
+             const circumspheres_t& spheres);
+
+float volume(int v,
+             const std::vector< std::pair<int, int> >& nbrs,
+             tet_t* tets,
+             float* particles,
+             const circumspheres_t& spheres);
+
+float volume(const voronoi_mesh_t& mesh,
+             int cell,
+             const circumspheres_t& spheres,
+             float* particles);
+
+void fill_volumes(float* volumes,
+                  float* areas,
+                  float* centroids,
+                  tet_t* tets,
+                  const vert_stars_t& stars,
+                  const circumspheres_t& spheres,
+                  float* particles,
+                  int num_particles,
+                  int num_threads = 1,
+                  const unsigned char* mirrors = NULL);
 
 #endif
@@ -0,0 +1,38 @@
+// C++ only header to use vector
+
+#ifndef _TESS_VORONOI_H
+#define _TESS_VORONOI_H
+
+#include <vector>
+#include <cstddef>
+#include "tet.hpp"
+#include "tet-neighbors.h"
+
+// Voronoi cells as a mesh; the vertices are the circumcenters of the tets
+// (circumspheres_t, indexed by tet), the faces and the cells are CSR lists:
+// the faces of cell c are cell_faces[c], ..., cell_faces[c + 1] - 1 and the
+// vertices of face f are verts[face_verts[f]], ..., verts[face_verts[f + 1] - 1]
+struct voronoi_mesh_t
+{
+    std::vector<int>   sites;                        // site (particle) of each cell
+    std::vector<int>   cell_faces;                   // offsets into the faces, one more than the cells
+    std::vector<int>   face_sites;                   // site on the other side of each face
+    std::vector<int>   face_verts;                   // offsets into verts, one more than the faces
+    std::vector<int>   verts;                        // vertices of the faces (tets), in order around the face
+    std::vector<float> normals;                      // optional outward unit normal of each face (x,y,z)
+
+    int                num_cells() const             { return (int)sites.size(); }
+    int                num_faces() const             { return (int)face_sites.size(); }
+};
+
+void fill_voronoi_mesh(voronoi_mesh_t&          mesh,
+                       const std::vector<int>&  sites,
+                       tet_t*                   tets,
+                       const vert_stars_t&      stars,
+                       const circumspheres_t&   spheres,
+                       float*                   particles,
+                       bool                     normals = false,
+                       int                      num_threads = 1,
+                       const unsigned char*     mirrors = NULL);
+
+#endif
@@ -14,9 +14,9 @@
 // --------------------------------------------------------------------------
 
 #include "tess/dense.hpp"
-#ifndef TESS_NO_OPENMP
-#include <omp.h>
-#endif
+#include "tess/volume.h"
+#include <algorithm>
+#include <map>
 
 using namespace std;
 
@@ -26,7 +26,7 @@ static double tot_mass = 0.0; // total output mass
 static float check_mass = 0.0; // ground truth total mass
 
 // density estimator
-void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
+void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC, ... (see alg)
            int num_given_bounds,      // number of given physical bounds of grid
            float *given_mins,         // given physical bounds of grid (x,y,z)
 	   float *given_maxs,
@@ -40,7 +40,9 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
 	   float *grid_step_size,     // physical size of grid space (x,y,z) (output)
            float eps,                 // floating point error threshold
            int *glo_num_idx,          // global number of grid points (i,j,k)
-           diy::Master& master)       // diy master object
+           diy::Master& master,       // diy master object
+           int num_threads,           // threads estimating the density of one block
+           bool tiled)                // store the density in tiles (not with project)
 {
   // local block grid parameters
   int block_min_idx[3];               // global grid index of block minimum grid point
@@ -79,6 +81,16 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
   args.glo_num_idx[0]    = glo_num_idx[0];
   args.glo_num_idx[1]    = glo_num_idx[1];
   args.glo_num_idx[2]    = glo_num_idx[2];
+  args.num_threads       = num_threads;
+  args.tiled             = tiled;
+
+  // debug stats of each block, so that the blocks can be processed by several threads
+  vector<dense_stats_t> stats(master.size(), dense_stats_t());
+  args.stats = stats.size() ? &stats[0] : NULL;
+  vector<covered_t> covered(master.size());
+  args.covered = covered.size() ? &covered[0] : NULL;
+  vector< vector<float> > rho(master.size());
+  args.rho = rho.size() ? &rho[0] : NULL;
 
   // allocate and initialize density field
   master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
@@ -89,6 +101,37 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
   args.div = (project ? grid_step_size[0] * grid_step_size[1] :
               grid_step_size[0] * grid_step_size[1] * grid_step_size[2]);
 
+  // DENSE_DTFE: densities at the original particles; the ghosts' are asked of their owners,
+  // which tess() may have linked only in its later rounds, so the requests and answers go
+  // over links of the neighbors of the last round (DBlock::round_neighbors)
+  if (alg_type == DENSE_DTFE && !project)
+  {
+    LinkVector original_links;
+    for (size_t i = 0; i < master.size(); i++)
+    {
+      original_links.push_back(*dynamic_cast<RCLink*>(master.link(i)));
+      DBlock* b = master.block<DBlock>(i);
+      if (b->round_neighbors.empty())         // not from tess(), or no neighbors
+        continue;
+      diy::Link* l = new diy::Link;
+      for (size_t j = 0; j < b->round_neighbors.size(); j++)
+        l->add_neighbor(b->round_neighbors[j]);
+      master.replace_link(i, l);
+    }
+
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                   { dtfe_rho(b, cp, &args); });
+    master.exchange();
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                   { send_ghost_rho(b, cp, &args); });
+    master.exchange();
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                   { recv_ghost_rho(b, cp, &args); });
+
+    for (size_t i = 0; i < master.size(); i++)
+      master.replace_link(i, new RCLink(original_links[i]));
+  }
+
   // estimate density
   master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
                  { est_dense(b, cp, &args); });
@@ -99,6 +142,15 @@ void dense(alg alg_type,              // algorithm DENSE_TESS, DENSE_CIC
   // process received points
   master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
                  { recvd_pts(b, cp, &args); });
+
+  // merge the stats in the order of the blocks
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    tot_mass   += stats[i].tot_mass;
+    check_mass += stats[i].check_mass;
+    if (stats[i].max_dense > max_dense)
+      max_dense = stats[i].max_dense;
+  }
 }
 
 // foreach block function to initialize density
@@ -113,18 +165,248 @@ void init_dense(DBlock*                         b,
   BlockGridParams(b, block_min_idx, block_max_idx, block_num_idx, a->grid_phys_mins,
                   a->grid_step_size, a->eps, a->data_mins, a->data_maxs, a->glo_num_idx);
 
+  free_density(b);                         // from a previous estimate
+
   int npts;                                // total number of points in the block
   if (a->project)
     npts = block_num_idx[0] * block_num_idx[1];
   else
     npts = block_num_idx[0] * block_num_idx[1] * block_num_idx[2];
-  b->density = new float[npts];
   b->num_grid_pts = npts;
 
+  // tiled: no tile is allocated until a density is assigned in it (see DensityTile())
+  if (a->tiled && !a->project)
+  {
+    b->num_density_tiles = ((block_num_idx[0] + DENSE_TILE - 1) / DENSE_TILE) *
+      ((block_num_idx[1] + DENSE_TILE - 1) / DENSE_TILE) *
+      ((block_num_idx[2] + DENSE_TILE - 1) / DENSE_TILE);
+    b->density_tiles = (float**)calloc(b->num_density_tiles, sizeof(float*));
+    return;
+  }
+
+  b->density = new float[npts];
+
   // init density
   memset(b->density, 0 , npts * sizeof(float));
 }
 
+// tile of the density field of a block that holds a grid point, and the offset of the point in
+// the tile; tile 0 is the whole density field if it is not tiled
+//
+// block: local block
+// block_grid_idx: index of the grid point in the block (i,j,k)
+// block_num_idx: number of grid points in block (x,y,z)
+// project: whether to project to 2D
+// proj_plane: normal to projection plane (x,y,z)
+// tile, off: (output) tile and offset in it
+static void GridPtTile(DBlock* block,
+                       int *block_grid_idx,
+                       int *block_num_idx,
+                       bool project,
+                       float *proj_plane,
+                       int& tile,
+                       int& off)
+{
+  if (!block->density_tiles)
+  {
+    tile = 0;
+    off = index(block_grid_idx, block_num_idx, project, proj_plane);
+    return;
+  }
+  int *g = block_grid_idx;
+  int tiles_x = (block_num_idx[0] + DENSE_TILE - 1) / DENSE_TILE;
+  int tiles_y = (block_num_idx[1] + DENSE_TILE - 1) / DENSE_TILE;
+  tile = ((g[2] / DENSE_TILE) * tiles_y + g[1] / DENSE_TILE) * tiles_x + g[0] / DENSE_TILE;
+  off = ((g[2] % DENSE_TILE) * DENSE_TILE + g[1] % DENSE_TILE) * DENSE_TILE + g[0] % DENSE_TILE;
+}
+
+// number of tiles of the density field of a block and of grid points in each
+static int NumTiles(DBlock* block)
+{
+  return (block->density_tiles ? block->num_density_tiles : 1);
+}
+static int TilePts(DBlock* block)
+{
+  return (block->density_tiles ? DENSE_TILE_PTS : block->num_grid_pts);
+}
+
+// density of one tile of a block, allocated with zero density on first use
+static float* DensityTile(DBlock* block,
+                          int tile)
+{
+  if (!block->density_tiles)
+    return block->density;
+  if (!block->density_tiles[tile])
+    block->density_tiles[tile] = (float*)calloc(DENSE_TILE_PTS, sizeof(float));
+  return block->density_tiles[tile];
+}
+
+// density of one grid point of a block
+static float* DensityPt(DBlock* block,
+                        int *block_grid_idx,
+                        int *block_num_idx,
+                        bool project,
+                        float *proj_plane)
+{
+  int tile, off;
+  GridPtTile(block, block_grid_idx, block_num_idx, project, proj_plane, tile, off);
+  return DensityTile(block, tile) + off;
+}
+
+// DENSE_DTFE flags of the grid points of one tile of a block, allocated on first use
+static unsigned char* CoveredTile(covered_t& covered,
+                                  DBlock* block,
+                                  int tile)
+{
+  if (covered[tile].empty())
+    covered[tile].assign(TilePts(block), 0);
+  return &covered[tile][0];
+}
+
+// current index of each original particle of a block, by its id in the input order
+static void InputToCurrent(DBlock* block,
+                           vector<int>& cur)
+{
+  int n_orig = block->num_orig_particles;
+  cur.resize(n_orig);
+  for (int p = 0; p < n_orig; p++)
+    cur[block->orig_ids ? block->orig_ids[p] : p] = p;
+}
+
+// link neighbor with a given gid, the first one if the link wraps to it more than once,
+// -1 if none
+static int LinkNeighbor(diy::Link* l,
+                        int gid)
+{
+  for (int i = 0; i < l->size(); i++)
+    if (l->target(i).gid == gid)
+      return i;
+  return -1;
+}
+
+// foreach block function to compute the DENSE_DTFE densities at the original particles,
+// mass / volume of the Voronoi cell or -1 if the cell is incomplete, and to ask the owners of
+// the ghost particles for theirs, one message of rem_lids per owner in the link; the ghosts
+// owned by the block itself (periodic) take their values directly, the others are
+// DENSE_NO_RHO until their owners answer
+void dtfe_rho(DBlock*                         b,
+              const diy::Master::ProxyWithLink& cp,
+              args_t*                           a)
+{
+  int lid = cp.master()->lid(cp.gid());
+  int n = b->num_particles;
+  int n_orig = b->num_orig_particles;
+  vector<float>& rho = a->rho[lid];
+  dense_stats_t& stats = a->stats[lid];
+
+  rho.assign(n, DENSE_NO_RHO);
+  fill(rho.begin(), rho.begin() + n_orig, -1.0);
+  if (b->num_tets && n_orig)
+  {
+    if (b->stars.offsets.empty())
+      fill_vert_stars(b->stars, b->tets, b->num_tets, n);
+    if (b->mirrors.empty())
+      fill_mirrors(b->mirrors, b->tets, b->num_tets, a->num_threads);
+    update_spheres(b);
+    fill_volumes(&rho[0], NULL, NULL, b->tets, b->stars, b->spheres, b->particles, n_orig,
+                 a->num_threads, &b->mirrors[0]);
+    for (int p = 0; p < n_orig; p++)
+    {
+      rho[p] = (rho[p] > 0.0 ? a->mass / rho[p] : -1.0);
+      if (rho[p] >= 0.0)
+        stats.check_mass++;
+    }
+  }
+  if (n == n_orig)
+    return;
+
+  // ghosts of the block itself
+  vector<int> cur;
+  InputToCurrent(b, cur);
+  for (int g = 0; g < n - n_orig; g++)
+    if (b->rem_gids[g] == b->gid && b->rem_lids[g] >= 0 && b->rem_lids[g] < n_orig)
+      rho[n_orig + g] = rho[cur[b->rem_lids[g]]];
+
+  // requests to the other owners
+  diy::Link* l = cp.link();
+  for (int i = 0; i < l->size(); i++)
+  {
+    int gid = l->target(i).gid;
+    if (gid == b->gid || LinkNeighbor(l, gid) != i)
+      continue;
+    vector<int> lids;
+    for (int g = 0; g < n - n_orig; g++)
+      if (b->rem_gids[g] == gid)
+        lids.push_back(b->rem_lids[g]);
+    if (!lids.empty())
+      cp.enqueue(l->target(i), &lids[0], lids.size());
+  }
+}
+
+// foreach block function to answer the requests of dtfe_rho() with the densities of the
+// requested original particles, in the order of the request
+void send_ghost_rho(DBlock*                         b,
+                    const diy::Master::ProxyWithLink& cp,
+                    args_t*                           a)
+{
+  int n_orig = b->num_orig_particles;
+  vector<float>& rho = a->rho[cp.master()->lid(cp.gid())];
+  diy::Link* l = cp.link();
+  vector<int> in;                          // gids of sources
+  cp.incoming(in);
+
+  vector<int> cur;
+  InputToCurrent(b, cur);
+  for (size_t i = 0; i < in.size(); i++)
+  {
+    int n = cp.incoming(in[i]).buffer.size() / sizeof(int);
+    int k = LinkNeighbor(l, in[i]);
+    if (!n || k < 0)
+      continue;
+    vector<int> lids(n);
+    cp.dequeue(in[i], &lids[0], n);
+    vector<float> vals(n);
+    for (int j = 0; j < n; j++)
+      vals[j] = (lids[j] >= 0 && lids[j] < n_orig ? rho[cur[lids[j]]] : -1.0);
+    cp.enqueue(l->target(k), &vals[0], n);
+  }
+}
+
+// foreach block function to receive the answers to the requests of dtfe_rho() into the
+// densities of the ghosts; warns about the ghosts whose owners sent none, which keep
+// DENSE_NO_RHO
+void recv_ghost_rho(DBlock*                         b,
+                    const diy::Master::ProxyWithLink& cp,
+                    args_t*                           a)
+{
+  int n_orig = b->num_orig_particles;
+  int n_ghosts = b->num_particles - n_orig;
+  vector<float>& rho = a->rho[cp.master()->lid(cp.gid())];
+  vector<int> in;                          // gids of sources
+  cp.incoming(in);
+
+  for (size_t i = 0; i < in.size(); i++)
+  {
+    int n = cp.incoming(in[i]).buffer.size() / sizeof(float);
+    if (!n)
+      continue;
+    vector<float> vals(n);
+    cp.dequeue(in[i], &vals[0], n);
+    int j = 0;                             // the ghosts of in[i], in the order of the request
+    for (int g = 0; g < n_ghosts && j < n; g++)
+      if (b->rem_gids[g] == in[i])
+        rho[n_orig + g] = vals[j++];
+  }
+
+  int missing = 0;
+  for (int g = 0; g < n_ghosts; g++)
+    if (rho[n_orig + g] == DENSE_NO_RHO)
+      missing++;
+  if (missing)
+    fprintf(stderr, "Warning: DENSE_DTFE block %d got no density for %d of its %d ghosts\n",
+            b->gid, missing, n_ghosts);
+}
+
 // foreach block function to estimate density
 void est_dense(DBlock*                         b,
                 const diy::Master::ProxyWithLink& cp,
@@ -137,28 +419,131 @@ void est_dense(DBlock*                         b,
   BlockGridParams(b, block_min_idx, block_max_idx, block_num_idx, a->grid_phys_mins,
                   a->grid_step_size, a->eps, a->data_mins, a->data_maxs, a->glo_num_idx);
 
+  dense_stats_t& stats = a->stats[cp.master()->lid(cp.gid())];
+  vector<grid_pt_t> off_block;             // grid points of the neighbors
+
   // iterate over cells, distributing density onto grid points
   switch (a->alg_type)
   {
   case DENSE_TESS:
-#if 0
-    // tess-based multithread estimator
-    IterateCellsOMP(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
-                    a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass, cp);
-#else
-    // tess-based single-thread estimator
-    IterateCells(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
-                 a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass, cp);
-#endif
+    if (a->num_threads > 1)
+      // tess-based multithread estimator
+      IterateCellsOMP(b, block_min_idx, block_num_idx, a->project, a->proj_plane,
+                      a->grid_phys_mins, a->grid_step_size, a->data_mins, a->data_maxs, a->eps,
+                      a->mass, off_block, stats, a->num_threads);
+    else
+      // tess-based single-thread estimator
+      IterateCells(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
+                   a->grid_step_size, a->data_mins, a->data_maxs, a->eps, a->mass, off_block,
+                   stats);
+    break;
+  case DENSE_DTFE:
+    // linear interpolation over the delaunay tets
+    if (a->project)
+    {
+      fprintf(stderr, "DENSE_DTFE does not support projection to 2D\n");
+      break;
+    }
+    IterateTetsDtfe(b, block_min_idx, block_num_idx, a->grid_phys_mins, a->grid_step_size,
+                    a->glo_num_idx, a->rho[cp.master()->lid(cp.gid())], a->div, off_block,
+                    stats, a->covered[cp.master()->lid(cp.gid())], a->num_threads);
+    vector<float>().swap(a->rho[cp.master()->lid(cp.gid())]);
     break;
   case DENSE_CIC:
-    // CIC-based estimator (only single threaded for now)
-    IterateCellsCic(b, block_min_idx, block_num_idx, a->project, a->proj_plane, a->grid_phys_mins,
-                    a->grid_step_size, a->data_maxs, a->eps, a->mass, cp);
+  case DENSE_TSC:
+  case DENSE_PCS:
+    // mass assignment of the particles, order 1 (CIC), 2 (TSC) or 3 (PCS)
+    IterateParticlesMas(b, (a->alg_type == DENSE_CIC ? 1 : a->alg_type == DENSE_TSC ? 2 : 3),
+                        block_min_idx, block_num_idx, a->project, a->proj_plane,
+                        a->grid_phys_mins, a->grid_step_size, a->mass, off_block, stats,
+                        a->num_threads);
     break;
   default:
     break;
   }
+
+  // send the grid points outside the block, one message per neighbor
+  SendGridPts(b, cp, a, off_block);
+}
+
+// order of grid points by global grid index (z, y, x)
+static bool GridPtLess(const grid_pt_t& a, const grid_pt_t& b)
+{
+  if (a.idx[2] != b.idx[2])
+    return a.idx[2] < b.idx[2];
+  if (a.idx[1] != b.idx[1])
+    return a.idx[1] < b.idx[1];
+  return a.idx[0] < b.idx[0];
+}
+
+// merges the grid points that a block found outside of itself and sends them to the
+// neighbors, one message per neighbor
+//
+// the points are sorted by global grid index and the masses of the same point are summed
+// (DENSE_DTFE: the first value is kept); each point goes to the neighbor whose grid points
+// (see BlockGridParams()) contain it, so a point is sent once and only to its owner
+//
+// b: local block
+// cp: communication proxy
+// a: auxiliary arguments
+// off_block: grid points outside the block (sorted and merged in place)
+void SendGridPts(DBlock*                         b,
+                 const diy::Master::ProxyWithLink& cp,
+                 args_t*                           a,
+                 vector<grid_pt_t>&                off_block)
+{
+  RCLink* l = dynamic_cast<RCLink*>(cp.link()); // link to block neighbors
+  if (off_block.empty())
+    return;
+
+  // sort, keeping the order of the values of the same point, and merge
+  stable_sort(off_block.begin(), off_block.end(), GridPtLess);
+  size_t n = 0;                                 // number of merged points
+  for (size_t i = 0; i < off_block.size(); i++)
+  {
+    if (n && !GridPtLess(off_block[n - 1], off_block[i]))
+    {
+      if (a->alg_type != DENSE_DTFE)
+        off_block[n - 1].mass += off_block[i].mass;
+    }
+    else
+      off_block[n++] = off_block[i];
+  }
+  off_block.resize(n);
+
+  // global grid index range of each neighbor
+  vector<int> nbr_min_idx(3 * l->size());
+  vector<int> nbr_max_idx(3 * l->size());
+  for (int i = 0; i < l->size(); i++)
+  {
+    int nbr_num_idx[3];
+    BlockGridParams(l->bounds(i), &nbr_min_idx[3 * i], &nbr_max_idx[3 * i], nbr_num_idx,
+                    a->grid_phys_mins, a->grid_step_size, a->eps, a->data_mins, a->data_maxs,
+                    a->glo_num_idx);
+  }
+
+  // sort the points into the neighbors' messages
+  vector< vector<grid_pt_t> > sends(l->size());
+  for (size_t j = 0; j < n; j++)
+  {
+    int *idx = off_block[j].idx;
+    for (int i = 0; i < l->size(); i++)
+    {
+      int *lo = &nbr_min_idx[3 * i];
+      int *hi = &nbr_max_idx[3 * i];
+      if (idx[0] >= lo[0] && idx[0] <= hi[0] &&
+          idx[1] >= lo[1] && idx[1] <= hi[1] &&
+          idx[2] >= lo[2] && idx[2] <= hi[2])
+      {
+        sends[i].push_back(off_block[j]);
+        break;
+      }
+    }
+  }
+
+  for (int i = 0; i < l->size(); i++)
+    if (!sends[i].empty())
+      cp.enqueue(l->target(i), &sends[i][0], sends[i].size());
 }
 
 // foreach block function to receive points
@@ -178,25 +563,122 @@ void recvd_pts(DBlock*                         b,
   BlockGridParams(b, block_min_idx, block_max_idx, block_num_idx, a->grid_phys_mins,
                   a->grid_step_size, a->eps, a->data_mins, a->data_maxs, a->glo_num_idx);
 
+  dense_stats_t& stats = a->stats[cp.master()->lid(cp.gid())];
+  covered_t& covered = a->covered[cp.master()->lid(cp.gid())];
+  if (a->alg_type == DENSE_DTFE && (int)covered.size() != NumTiles(b))
+    covered.assign(NumTiles(b), vector<unsigned char>());
+
+  // one message per neighbor, each grid point in it once (see SendGridPts())
+  vector<grid_pt_t> grid_pts;
+  vector<float*> dens;                     // densities of the grid points of the message
+  vector<unsigned char*> cvs;              // DENSE_DTFE: their flags
   for (size_t i = 0; i < in.size(); i++)   // links
   {
     int numpts = cp.incoming(in[i]).buffer.size() / sizeof(grid_pt_t);
-    vector<grid_pt_t> grid_pts(numpts);
+    if (!numpts)
+      continue;
+    grid_pts.resize(numpts);
+    dens.resize(numpts);
+    cvs.resize(numpts);
     cp.dequeue(in[i], &grid_pts[0], numpts);
-    for (size_t j = 0; j < numpts; j++)    // items in the link
+    for (int j = 0; j < numpts; j++)
     {
-      // assign the density in the local block array
       int block_grid_idx[3]; // indices in local block array
       Global2LocalIdx(grid_pts[j].idx, block_grid_idx, block_min_idx);
-      int idx = index(block_grid_idx, block_num_idx, a->project, a->proj_plane);
-      b->density[idx] += (grid_pts[j].mass / a->div);
+      int tile, off;
+      GridPtTile(b, block_grid_idx, block_num_idx, a->project, a->proj_plane, tile, off);
+      dens[j] = DensityTile(b, tile) + off;
+      if (a->alg_type == DENSE_DTFE)
+        cvs[j] = CoveredTile(covered, b, tile) + off;
+    }
 
-      // debug
-      tot_mass += grid_pts[j].mass;
-      if (b->density[idx] > max_dense)
-        max_dense = b->density[idx];
+    // assign the density in the local block array
+    double msg_mass = 0.0;
+    if (a->alg_type == DENSE_DTFE)
+    {
+      // interpolated value, unless the point has one already (first neighbor wins)
+      for (int j = 0; j < numpts; j++)
+      {
+        if (*cvs[j])
+          continue;
+        *cvs[j] = 1;
+        *dens[j] = grid_pts[j].mass / a->div;
+        msg_mass += grid_pts[j].mass;
+      }
+    }
+    else
+    {
+      for (int j = 0; j < numpts; j++)
+      {
+        *dens[j] += (grid_pts[j].mass / a->div);
+        msg_mass += grid_pts[j].mass;
+      }
+    }
 
+    // debug
+    stats.tot_mass += msg_mass;
+    for (int j = 0; j < numpts; j++)
+      if (*dens[j] > stats.max_dense)
+        stats.max_dense = *dens[j];
+  }
+}
+
+// assign the density of the grid points covered by one cell to the block,
+// or collect the grid points outside of the block for the neighboring blocks
+//
+// block: local block
+// grid_pts: grid points covered by the cell
+// num_grid_pts: number of grid points
+// block_min_idx: minimum (i,j,k) grid point index in block
+// block_num_idx: number of grid points in block (x,y,z)
+// project: whether to project to 2D
+// proj_plane: normal to projection plane (x,y,z)
+// grid_phys_mins: physical global min grid corner position (x,y,z)
+// grid_step_size: physical size of one grid space (x,y,z)
+// div: volume (3d density) or area (2d density) of one grid space
+// off_block: (output) grid points outside the block are appended
+//
+// side effects: writes density
+static void AssignGridPts(DBlock* block,
+                          grid_pt_t *grid_pts,
+                          int num_grid_pts,
+                          int *block_min_idx,
+                          int *block_num_idx,
+                          bool project,
+                          float *proj_plane,
+                          float *grid_phys_mins,
+                          float *grid_step_size,
+                          float div,
+                          vector<grid_pt_t>& off_block,
+                          dense_stats_t& stats)
+{
+  // debug: check consistency
+  stats.check_mass++;
+
+  // grid points covered by cell
+  for (int i = 0; i < num_grid_pts; i++)
+  {
+    int block_grid_idx[3]; // local block idx of grid point
+    Global2LocalIdx(grid_pts[i].idx, block_grid_idx, block_min_idx);
+
+    // assign density to grid points in the block
+    if (block_grid_idx[0] >= 0 && block_grid_idx[0] < block_num_idx[0] &&
+        block_grid_idx[1] >= 0 && block_grid_idx[1] < block_num_idx[1] &&
+        block_grid_idx[2] >= 0 && block_grid_idx[2] < block_num_idx[2])
+    {
+      // assign the density to the local block density array
+      float *d = DensityPt(block, block_grid_idx, block_num_idx, project, proj_plane);
+      *d += (grid_pts[i].mass / div);
+
+      // consistency checks and stats
+      stats.tot_mass += grid_pts[i].mass;
+      if (*d > stats.max_dense)
+        stats.max_dense = *d;
     }
+
+    // or keep grid points for neighboring blocks
+    else
+      off_block.push_back(grid_pts[i]);
   }
 }
 
@@ -213,9 +695,9 @@ void recvd_pts(DBlock*                         b,
 // data_mins, data_maxs: global data physical extent (x,y,z)
 // eps: floating point error tolerance
 // mass: mass of 1 particle
-// cp: communication proxy
+// off_block: (output) grid points outside the block are appended
 //
-// side effects: writes density or sends to neighbors
+// side effects: writes density
 void IterateCells(DBlock* block,
                   int *block_min_idx,
                   int *block_num_idx,
@@ -227,83 +709,51 @@ void IterateCells(DBlock* block,
                   float *data_maxs,
                   float eps,
                   float mass,
-                  const diy::Master::ProxyWithLink& cp)
+                  vector<grid_pt_t>& off_block,
+                  dense_stats_t& stats)
 {
   int alloc_grid_pts = 0;                       // number of grid points allocated
   grid_pt_t *grid_pts = NULL;                   // grid points covered by the cell
   int *border = NULL;                           // cell border, min,max x index for each y, z index
   int num_grid_pts;                             // number of grid points
-  RCLink* l = dynamic_cast<RCLink*>(cp.link()); // link to block neighbors
 
   // divisor for volume (3d density) or area (2d density)
   // assumes projection is to x-y plane
   float div = (project ? grid_step_size[0] * grid_step_size[1] :
 	       grid_step_size[0] * grid_step_size[1] * grid_step_size[2]);
 
-  // cells
-  for (int cell = 0; cell < block->num_orig_particles; cell++)
+  // the complete cells, with face normals, DENSE_CELL_CHUNK sites at a time so that the mesh
+  // of the whole block is never held at once
+  voronoi_mesh_t mesh;
+  for (int chunk = 0; chunk < block->num_orig_particles; chunk += DENSE_CELL_CHUNK)
   {
-    float cell_min[3], cell_max[3]; // cell bounds
-    float grid_pos[3]; // physical position of grid point
-
-    // skip inccomplete cells
-    if (block->vert_to_tet[cell] == -1 ||
-        !complete(cell, block->tets, block->num_tets, block->vert_to_tet[cell]))
-      continue;
+    fill_voronoi_mesh(mesh, block, true, 1, chunk, chunk + DENSE_CELL_CHUNK);
 
-    vector <float> normals; // cell normals
-    vector <vector <float> > face_verts; // vertex positions in each face
-
-    // cell bounds
-    CellBounds(block, cell, cell_min, cell_max, normals, face_verts);
+    // cells
+    for (int c = 0; c < mesh.num_cells(); c++)
+    {
+      int cell = mesh.sites[c]; // site of the cell
+      float cell_min[3], cell_max[3]; // cell bounds
 
-    // grid points covered by this cell
-    num_grid_pts = CellGridPts(cell_min, cell_max, grid_pts, border,
-			       alloc_grid_pts, normals, face_verts, data_mins,
-			       data_maxs, grid_phys_mins, grid_step_size,
-			       mass, eps, &(block->particles[3 * cell]));
+      vector <float> normals; // cell normals
+      vector <vector <float> > face_verts; // vertex positions in each face
 
-    if (!num_grid_pts) // cell outside of global data bounds
-      continue;
+      // cell bounds
+      CellBounds(mesh, c, block->spheres, cell_min, cell_max, normals, face_verts);
 
-    // debug: check consistency
-    check_mass++;
+      // grid points covered by this cell
+      num_grid_pts = CellGridPts(cell_min, cell_max, grid_pts, border,
+                                 alloc_grid_pts, normals, face_verts, data_mins,
+                                 data_maxs, grid_phys_mins, grid_step_size,
+                                 mass, eps, &(block->particles[3 * cell]));
 
-    // grid points covered by cell
-    for (int i = 0; i < num_grid_pts; i++)
-    {
-      idx2phys(grid_pts[i].idx, grid_pos, grid_step_size, grid_phys_mins);
-
-      // assign density to grid points in the block
-      if (grid_pos[0] >= block->bounds.min[0] &&
-	  grid_pos[0] <= block->bounds.max[0] &&
-	  grid_pos[1] >= block->bounds.min[1] &&
-	  grid_pos[1] <= block->bounds.max[1] &&
-	  grid_pos[2] >= block->bounds.min[2] &&
-          grid_pos[2] <= block->bounds.max[2])
-      {
-	// assign the density to the local block density array
-	int block_grid_idx[3]; // local block idx of grid point
-	Global2LocalIdx(grid_pts[i].idx, block_grid_idx, block_min_idx);
-	int idx = index(block_grid_idx, block_num_idx, project, proj_plane);
-	block->density[idx] += (grid_pts[i].mass / div);
-
-	// consistency checks and stats
-	tot_mass += grid_pts[i].mass;
-	if (block->density[idx] > max_dense)
-	  max_dense = block->density[idx];
-      }
+      if (!num_grid_pts) // cell outside of global data bounds
+        continue;
 
-      // or send grid points to neighboring blocks
-      else
-      {
-        set<int> dests; // destination neighbor edges for this point
-        in(*l, grid_pos, std::inserter(dests, dests.end()), block->data_bounds);
-        for (set<int>::iterator it = dests.begin(); it != dests.end(); it++)
-          cp.enqueue(l->target(*it), grid_pts[i]);
-      }
-    } // grid points covered by cell
-  } // cells
+      AssignGridPts(block, grid_pts, num_grid_pts, block_min_idx, block_num_idx, project,
+                    proj_plane, grid_phys_mins, grid_step_size, div, off_block, stats);
+    } // cells
+  } // chunks
 
   if (grid_pts)
     free(grid_pts);
@@ -311,10 +761,12 @@ void IterateCells(DBlock* block,
     free(border);
 }
 
-#ifndef TESS_NO_OPENMP
-
 // iterate over cells and assign single density to grid point
-// openMP version
+// multithreaded version
+//
+// the threads find the grid points covered by the cells, the largest cells first, and the
+// density is then assigned in the order of the cells, a chunk of sites at a time, so that
+// the result is the same as IterateCells() for any number of threads
 //
 // block: local block
 // block_min_idx: minimum (i,j,k) grid point index in block
@@ -326,9 +778,10 @@ void IterateCells(DBlock* block,
 // data_mins, data_maxs: global data physical extent (x,y,z)
 // eps: floating point error tolerance
 // mass: mass of 1 particle
-// cp: communication proxy
+// off_block: (output) grid points outside the block are appended
+// num_threads: number of threads
 //
-// side effects: writes density or sends to neighbors
+// side effects: writes density
 void IterateCellsOMP(DBlock* block,
                      int *block_min_idx,
                      int *block_num_idx,
@@ -340,127 +793,616 @@ void IterateCellsOMP(DBlock* block,
                      float *data_maxs,
                      float eps,
                      float mass,
-                     const diy::Master::ProxyWithLink& cp)
+                     vector<grid_pt_t>& off_block,
+                     dense_stats_t& stats,
+                     int num_threads)
 {
-  int nthreads;                                 // number of threads currently being used
-  int mthreads = omp_get_max_threads();         // max threads that could be used
-  vector<grid_pt_t> enq_grid_pts[mthreads];     // enqueued grid pts for each thread
-  RCLink* l = dynamic_cast<RCLink*>(cp.link()); // link to block neighbors
-
   // divisor for volume (3d density) or area (2d density)
   // assumes projection is to x-y plane
   float div = (project ? grid_step_size[0] * grid_step_size[1] :
 	       grid_step_size[0] * grid_step_size[1] * grid_step_size[2]);
 
-  omp_set_num_threads(8);  // number of threads for BGQ must be set manually, 8 threads * 8 ppn
+  voronoi_mesh_t mesh;                      // complete cells of the chunk, with face normals
+  vector<float> work;                       // estimated work of each cell of the chunk
+  vector<int> order;                        // cells of the chunk, largest first
+  vector< vector<grid_pt_t> > cell_pts;     // grid points covered by each cell of the chunk
 
-#pragma omp parallel
+  // DENSE_CELL_CHUNK sites at a time, so that neither the mesh nor the grid points of the whole
+  // block are held at once
+  for (int chunk = 0; chunk < block->num_orig_particles; chunk += DENSE_CELL_CHUNK)
   {
-    nthreads = omp_get_num_threads();
+    // the mesh is built before the threads share it
+    fill_voronoi_mesh(mesh, block, true, num_threads, chunk, chunk + DENSE_CELL_CHUNK);
+    int num_cells = mesh.num_cells();
 
-    // debug
-    // fprintf(stderr, "using OpenMP version, num threads = %d\n", nthreads);
+    // estimated work of each cell: grid spaces in the bounding box of its vertices
+    work.resize(num_cells);
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (int c = 0; c < num_cells; c++)
+    {
+      int first = mesh.face_verts[mesh.cell_faces[c]];
+      int last  = mesh.face_verts[mesh.cell_faces[c + 1]];
+      if (first == last)
+      {
+        work[c] = 0;
+        continue;
+      }
+      float cell_min[3], cell_max[3];
+      cell_min[0] = cell_max[0] = block->spheres.x[mesh.verts[first]];
+      cell_min[1] = cell_max[1] = block->spheres.y[mesh.verts[first]];
+      cell_min[2] = cell_max[2] = block->spheres.z[mesh.verts[first]];
+      for (int k = first + 1; k < last; k++)
+      {
+        int t = mesh.verts[k];
+        cell_min[0] = min(cell_min[0], block->spheres.x[t]);
+        cell_min[1] = min(cell_min[1], block->spheres.y[t]);
+        cell_min[2] = min(cell_min[2], block->spheres.z[t]);
+        cell_max[0] = max(cell_max[0], block->spheres.x[t]);
+        cell_max[1] = max(cell_max[1], block->spheres.y[t]);
+        cell_max[2] = max(cell_max[2], block->spheres.z[t]);
+      }
+      work[c] = 1;
+      for (int j = 0; j < 3; j++)
+        work[c] *= (cell_max[j] - cell_min[j]) / grid_step_size[j] + 1;
+    }
 
-    // objects defined inside the thread block are private to the thread
-    int alloc_grid_pts = 0; // number of grid points allocated
-    grid_pt_t *grid_pts = NULL; // grid points covered by the cell
-    int *border = NULL; // cell border, min and max x index for each y, z index
-    int num_grid_pts; // number of grid points
-    int tid = omp_get_thread_num(); // thread id
+    order.resize(num_cells);
+    for (int i = 0; i < num_cells; i++)
+      order[i] = i;
+    stable_sort(order.begin(), order.end(), [&work](int a, int b) { return work[a] > work[b]; });
+    cell_pts.resize(num_cells);
 
-#pragma omp for
-    // cells
-    for (int cell = 0; cell < block->num_orig_particles; cell++)
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
     {
-      float cell_min[3], cell_max[3]; // cell bounds
-      float grid_pos[3]; // physical position of grid point
-
-      // skip inccomplete cells
-      if (!complete(cell, block->tets, block->num_tets,
-		    block->vert_to_tet[cell]))
-	continue;
+      // objects defined inside the thread block are private to the thread
+      int alloc_grid_pts = 0; // number of grid points allocated
+      grid_pt_t *grid_pts = NULL; // grid points covered by the cell
+      int *border = NULL; // cell border, min and max x index for each y, z index
 
-      vector <float> normals; // cell normals
-      vector <vector <float> > face_verts; // vertex positions in each face
+#ifndef TESS_NO_OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+      for (int i = 0; i < num_cells; i++)
+      {
+        int c = order[i];
+        int cell = mesh.sites[c]; // site of the cell
+        float cell_min[3], cell_max[3]; // cell bounds
+
+        vector <float> normals; // cell normals
+        vector <vector <float> > face_verts; // vertex positions in each face
+
+        // cell bounds
+        CellBounds(mesh, c, block->spheres, cell_min, cell_max, normals, face_verts);
+
+        // grid points covered by this cell
+        int num_grid_pts = CellGridPts(cell_min, cell_max, grid_pts, border,
+                                       alloc_grid_pts, normals, face_verts, data_mins,
+                                       data_maxs, grid_phys_mins, grid_step_size,
+                                       mass, eps, &(block->particles[3 * cell]));
+        cell_pts[c].assign(grid_pts, grid_pts + num_grid_pts);
+      } // cells
+
+      if (grid_pts)
+        free(grid_pts);
+      if (border)
+        free(border);
+    } // parallel block
+
+    // assign the density in the order of the cells
+    for (int c = 0; c < num_cells; c++)
+    {
+      if (cell_pts[c].empty()) // cell outside of global data bounds
+        continue;
+      AssignGridPts(block, &cell_pts[c][0], cell_pts[c].size(), block_min_idx, block_num_idx,
+                    project, proj_plane, grid_phys_mins, grid_step_size, div, off_block,
+                    stats);
+    }
+  } // chunks
+}
 
-      // cell bounds
-      CellBounds(block, cell, cell_min, cell_max, normals, face_verts);
+// DTFE (Delaunay tessellation field estimator): the density at each particle is its mass
+// over the volume of its Voronoi cell, linearly interpolated over the delaunay tets; the
+// densities of the ghosts are those their owners computed over their complete cells
+//
+// the tets with at least one original particle and densities at all their vertices are
+// rasterized in index order, each thread over its own slab of grid z indices, so the value of
+// a grid point on a face shared by tets comes from the last one for any number of threads;
+// grid points outside the block are sent to the neighbors, which keep the first value they
+// receive for a point that none of their own tets covers
+//
+// block: local block
+// block_min_idx: minimum (i,j,k) grid point index in block
+// block_num_idx: number of grid points in block (x,y,z)
+// grid_phys_mins: physical global min grid corner position (x,y,z)
+// grid_step_size: physical size of one grid space (x,y,z)
+// glo_num_idx: global number of grid points (i,j,k)
+// rho: densities at the particles, the ghosts' from their owners, -1 for an incomplete cell,
+//      DENSE_NO_RHO for a ghost whose owner sent none (see dtfe_rho())
+// div: volume of one grid space
+// off_block: (output) grid points outside the block are appended
+// covered: (output) grid points of the block that got a value, by density tile
+// num_threads: number of threads
+//
+// side effects: writes density
+void IterateTetsDtfe(DBlock* block,
+                     int *block_min_idx,
+                     int *block_num_idx,
+                     float *grid_phys_mins,
+                     float *grid_step_size,
+                     int *glo_num_idx,
+                     const vector<float>& rho,
+                     float div,
+                     vector<grid_pt_t>& off_block,
+                     dense_stats_t& stats,
+                     covered_t& covered,
+                     int num_threads)
+{
+  int n_orig = block->num_orig_particles;
+  float *particles = block->particles;
+  tet_t *tets = block->tets;
+
+  covered.assign(NumTiles(block), vector<unsigned char>());
+  if (!block->density_tiles)
+    CoveredTile(covered, block, 0);          // shared by the threads, allocated before them
+  if (!block->num_tets)
+    return;
+
+  // tets to rasterize and their range of grid z indices
+  vector<int> dtets;
+  vector<int> tet_z; // min, max z index of each tet in dtets
+  int z_min = glo_num_idx[2], z_max = -1;
+  int unreceived = 0; // tets left out for a ghost without a density
+  for (int t = 0; t < block->num_tets; t++)
+  {
+    bool orig = false, known = true, received = true;
+    float lo = particles[3 * tets[t].verts[0] + 2], hi = lo;
+    for (int i = 0; i < 4; i++)
+    {
+      int v = tets[t].verts[i];
+      orig |= (v < n_orig);
+      known &= (rho[v] >= 0.0);
+      received &= (rho[v] != DENSE_NO_RHO);
+      lo = min(lo, particles[3 * v + 2]);
+      hi = max(hi, particles[3 * v + 2]);
+    }
+    if (orig && !received)
+      unreceived++;
+    if (!orig || !known)
+      continue;
+    int z0 = max(0, (int)ceilf((lo - grid_phys_mins[2]) / grid_step_size[2]));
+    int z1 = min(glo_num_idx[2] - 1, (int)floorf((hi - grid_phys_mins[2]) / grid_step_size[2]));
+    if (z0 > z1)
+      continue;
+    dtets.push_back(t);
+    tet_z.push_back(z0);
+    tet_z.push_back(z1);
+    z_min = min(z_min, z0);
+    z_max = max(z_max, z1);
+  }
+  if (unreceived)
+    fprintf(stderr, "Warning: DENSE_DTFE block %d leaves out %d tets whose ghosts have no "
+            "density\n", block->gid, unreceived);
+  if (z_max < z_min)
+    return;
+
+  int nthreads = max(1, min(num_threads, z_max - z_min + 1));
+  vector< map<long long, grid_pt_t> > nbr_pts(nthreads); // grid points for the neighbors
+
+  // first z index of each thread's slab; the slabs of a tiled density field start at a tile,
+  // so that each tile is allocated and written by one thread
+  vector<int> slabs(nthreads + 1);
+  for (int s = 0; s <= nthreads; s++)
+  {
+    slabs[s] = z_min + (long)(z_max - z_min + 1) * s / nthreads;
+    int bz = slabs[s] - block_min_idx[2];
+    if (block->density_tiles && s > 0 && s < nthreads && bz > 0)
+      slabs[s] = min(z_max + 1, block_min_idx[2] + (bz + DENSE_TILE - 1) / DENSE_TILE * DENSE_TILE);
+  }
 
-      // grid points covered by this cell
-      num_grid_pts = CellGridPts(cell_min, cell_max, grid_pts, border,
-				 alloc_grid_pts, normals, face_verts, data_mins,
-				 data_maxs, grid_phys_mins, grid_step_size,
-				 mass, eps, &(block->particles[3 * cell]));
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+  for (int s = 0; s < nthreads; s++)
+  {
+    // this thread's slab of z indices
+    int s0 = slabs[s];
+    int s1 = slabs[s + 1] - 1;
 
-      if (!num_grid_pts) // cell outside of global data bounds
-	continue;
+    for (size_t k = 0; k < dtets.size(); k++)
+    {
+      int z0 = max(tet_z[2 * k], s0);
+      int z1 = min(tet_z[2 * k + 1], s1);
+      if (z0 > z1)
+        continue;
+      tet_t& tet = tets[dtets[k]];
+
+      // barycentric coordinates lambda_i(p) = g_i . p + h_i and the interpolated density
+      // g . p + h, in double
+      double v[4][3], e[3][3], g[4][3], h[4], gf[3] = { 0, 0, 0 }, hf = 0;
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 3; j++)
+          v[i][j] = particles[3 * tet.verts[i] + j];
+      for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+          e[i][j] = v[i + 1][j] - v[0][j];
+      for (int i = 0; i < 3; i++)
+      {
+        const double *a = e[(i + 1) % 3], *b = e[(i + 2) % 3];
+        g[i + 1][0] = a[1] * b[2] - a[2] * b[1];
+        g[i + 1][1] = a[2] * b[0] - a[0] * b[2];
+        g[i + 1][2] = a[0] * b[1] - a[1] * b[0];
+      }
+      double det = e[0][0] * g[1][0] + e[0][1] * g[1][1] + e[0][2] * g[1][2];
+      if (det == 0.0)
+        continue;
+      h[0] = 1.0;
+      for (int j = 0; j < 3; j++)
+        g[0][j] = 0.0;
+      for (int i = 1; i < 4; i++)
+      {
+        for (int j = 0; j < 3; j++)
+        {
+          g[i][j] /= det;
+          g[0][j] -= g[i][j];
+        }
+        h[i] = -(g[i][0] * v[0][0] + g[i][1] * v[0][1] + g[i][2] * v[0][2]);
+        h[0] -= h[i];
+      }
+      for (int i = 0; i < 4; i++)
+      {
+        float r = rho[tet.verts[i]];
+        for (int j = 0; j < 3; j++)
+          gf[j] += r * g[i][j];
+        hf += r * h[i];
+      }
 
-      // debug: consistency check
-#pragma omp atomic
-      check_mass++;
+      // y range of the tet
+      double y_lo = v[0][1], y_hi = v[0][1];
+      for (int i = 1; i < 4; i++)
+      {
+        y_lo = min(y_lo, v[i][1]);
+        y_hi = max(y_hi, v[i][1]);
+      }
+      int y0 = max(0, (int)ceil((y_lo - grid_phys_mins[1]) / grid_step_size[1]));
+      int y1 = min(glo_num_idx[1] - 1, (int)floor((y_hi - grid_phys_mins[1]) / grid_step_size[1]));
 
-      // iterate over grid points covered by cell
-      for (int i = 0; i < num_grid_pts; i++)
+      const double tol = 1e-7; // of the barycentric coordinates
+      for (int zi = z0; zi <= z1; zi++)
       {
-	idx2phys(grid_pts[i].idx, grid_pos, grid_step_size, grid_phys_mins);
-
-        // assign density to grid points in the block
-        if (grid_pos[0] >= block->bounds.min[0] &&
-            grid_pos[0] <= block->bounds.max[0] &&
-            grid_pos[1] >= block->bounds.min[1] &&
-            grid_pos[1] <= block->bounds.max[1] &&
-            grid_pos[2] >= block->bounds.min[2] &&
-            grid_pos[2] <= block->bounds.max[2])
+        double z = zi * grid_step_size[2] + grid_phys_mins[2];
+        for (int yi = y0; yi <= y1; yi++)
         {
-	  // assign the density to the local block density array
-	  int block_grid_idx[3]; // local block idx of grid point
-	  Global2LocalIdx(grid_pts[i].idx, block_grid_idx, block_min_idx);
-	  int idx = index(block_grid_idx, block_num_idx, project, proj_plane);
-#pragma omp atomic
-	  block->density[idx] += (grid_pts[i].mass / div);
-
-	  // consistency check and output stats
-#pragma omp atomic // only the next statement is atomic
-	  tot_mass += grid_pts[i].mass;
-	  if (block->density[idx] > max_dense)
-	    max_dense = block->density[idx];
-	}
-
-	// or send grid points to neighboring blocks
-	else
-	  enq_grid_pts[tid].push_back(grid_pts[i]);
-      } // grid points covered by cell
-    } // cells
+          double y = yi * grid_step_size[1] + grid_phys_mins[1];
 
-    if (grid_pts)
-      free(grid_pts);
-    if (border)
-      free(border);
+          // x interval where all lambda_i >= -tol
+          double lo = -numeric_limits<double>::max(), hi = numeric_limits<double>::max();
+          bool empty = false;
+          for (int i = 0; i < 4; i++)
+          {
+            double c = g[i][1] * y + g[i][2] * z + h[i] + tol;
+            if (g[i][0] > 0.0)
+              lo = max(lo, -c / g[i][0]);
+            else if (g[i][0] < 0.0)
+              hi = min(hi, -c / g[i][0]);
+            else if (c < 0.0)
+              empty = true;
+          }
+          if (empty || lo > hi)
+            continue;
+          double fx0 = ceil((lo - grid_phys_mins[0]) / grid_step_size[0]);
+          double fx1 = floor((hi - grid_phys_mins[0]) / grid_step_size[0]);
+          int x0 = (int)max(fx0, 0.0);
+          int x1 = (int)min(fx1, (double)(glo_num_idx[0] - 1));
+          if (x0 > x1)
+            continue;
+
+          double c = gf[1] * y + gf[2] * z + hf; // density along the line: gf[0] * x + c
+
+          // the part in the block
+          int by = yi - block_min_idx[1], bz = zi - block_min_idx[2];
+          int bx0 = max(x0, block_min_idx[0]);
+          int bx1 = min(x1, block_min_idx[0] + block_num_idx[0] - 1);
+          bool in_block = (by >= 0 && by < block_num_idx[1] && bz >= 0 && bz < block_num_idx[2]);
+          int bx = block_min_idx[0];
+          for (int xs = bx0; in_block && xs <= bx1; )
+          {
+            // the part of the row in one tile (the whole row if the density is not tiled)
+            int xe = bx1;
+            if (block->density_tiles)
+              xe = min(bx1, bx + ((xs - bx) / DENSE_TILE + 1) * DENSE_TILE - 1);
+            int block_grid_idx[3] = { xs - bx, by, bz };
+            int tile, off;
+            GridPtTile(block, block_grid_idx, block_num_idx, false, NULL, tile, off);
+            float *d = DensityTile(block, tile) + off;
+            unsigned char *cv = CoveredTile(covered, block, tile) + off;
+#pragma omp simd
+            for (int xi = xs; xi <= xe; xi++)
+            {
+              d[xi - xs] = gf[0] * (xi * grid_step_size[0] + grid_phys_mins[0]) + c;
+              cv[xi - xs] = 1;
+            }
+            xs = xe + 1;
+          }
+
+          // the rest goes to the neighbors
+          for (int xi = x0; xi <= x1; xi++)
+          {
+            if (in_block && xi >= bx0 && xi <= bx1)
+              continue;
+            grid_pt_t pt;
+            pt.idx[0] = xi;
+            pt.idx[1] = yi;
+            pt.idx[2] = zi;
+            pt.mass = (gf[0] * (xi * grid_step_size[0] + grid_phys_mins[0]) + c) * div;
+            long long key = ((long long)zi * glo_num_idx[1] + yi) * glo_num_idx[0] + xi;
+            nbr_pts[s][key] = pt;
+          }
+        } // y
+      } // z
+    } // tets
+  } // slabs
+
+  // stats of the local grid points, in order
+  for (int t = 0; t < NumTiles(block); t++)
+  {
+    if (covered[t].empty())
+      continue;
+    float *d = DensityTile(block, t);
+    for (int i = 0; i < TilePts(block); i++)
+    {
+      if (!covered[t][i])
+        continue;
+      stats.tot_mass += d[i] * div;
+      if (d[i] > stats.max_dense)
+        stats.max_dense = d[i];
+    }
+  }
 
-  } // parallel block
+  // grid points for neighboring blocks, in the order of the slabs
+  for (int s = 0; s < nthreads; s++)
+    for (map<long long, grid_pt_t>::iterator it = nbr_pts[s].begin(); it != nbr_pts[s].end(); it++)
+      off_block.push_back(it->second);
+}
 
-  // send grid points to neighboring blocks
-  float grid_pos[3]; // physical position of grid point
-  for (int i = 0; i < nthreads; i++)
+// mass assignment weights of a batch of particles along one axis
+//
+// order: 1 (CIC), 2 (TSC), 3 (PCS); order + 1 grid points get a weight
+// u: positions of the particles in grid spaces from the grid minimum
+// n: number of particles
+// first: (output) grid index of the first grid point of each particle
+// w: (output) weights, w[k * n + p] for grid point first[p] + k of particle p
+static void MasWeights(int order,
+                       const float *u,
+                       int n,
+                       int *first,
+                       float *w)
+{
+  switch (order)
   {
-    for (int j = 0; j < (int)(enq_grid_pts[i].size()); j++)
+  case 1: // cloud in cell: the 2 nearest grid points
+#pragma omp simd
+    for (int p = 0; p < n; p++)
     {
-      idx2phys(enq_grid_pts[i][j].idx, grid_pos, grid_step_size,
-	       grid_phys_mins);
-        set<int> dests; // destination neighbor edges for this point
-        in(*l, grid_pos, std::inserter(dests, dests.end()), block->data_bounds);
-        for (set<int>::iterator it = dests.begin(); it != dests.end(); it++)
-          cp.enqueue(l->target(*it), enq_grid_pts[i][j]);
+      float f = floorf(u[p]);
+      float t = u[p] - f;
+      first[p] = (int)f;
+      w[p] = 1.0f - t;
+      w[n + p] = t;
     }
+    break;
+  case 2: // triangular shaped cloud: the nearest grid point and the 2 around it
+#pragma omp simd
+    for (int p = 0; p < n; p++)
+    {
+      float c = floorf(u[p] + 0.5f);
+      float d = u[p] - c;
+      first[p] = (int)c - 1;
+      w[p] = 0.5f * (0.5f - d) * (0.5f - d);
+      w[n + p] = 0.75f - d * d;
+      w[2 * n + p] = 0.5f * (0.5f + d) * (0.5f + d);
+    }
+    break;
+  default: // piecewise cubic spline: the 4 nearest grid points
+#pragma omp simd
+    for (int p = 0; p < n; p++)
+    {
+      float f = floorf(u[p]);
+      float t = u[p] - f, r = 1.0f - t;
+      first[p] = (int)f - 1;
+      w[p] = r * r * r / 6.0f;
+      w[n + p] = (4.0f - 6.0f * t * t + 3.0f * t * t * t) / 6.0f;
+      w[2 * n + p] = (4.0f - 6.0f * r * r + 3.0f * r * r * r) / 6.0f;
+      w[3 * n + p] = t * t * t / 6.0f;
+    }
+    break;
   }
-
-  // clean up grid enqueued grid points todo: are they freed automatically
-  // when the array of vectors goes out of scope?
-  for (int i = 0; i < nthreads; i++)
-    enq_grid_pts[i].clear();
 }
 
+// assigns the mass of the particles to the grid points around them with the cloud in cell
+// (CIC), triangular shaped cloud (TSC) or piecewise cubic spline (PCS) kernel
+//
+// the weights are computed for DENSE_MAS_BATCH particles at a time; each thread owns a slab of
+// grid z indices and deposits the parts of the stencils in its slab, in the order of the
+// particles, so the density is the same for any number of threads (one thread if project); the rows of the stencils
+// inside the block are added to the density in place, the grid points outside the block are
+// kept for the neighbors
+//
+// block: local block
+// order: 1 (CIC), 2 (TSC), 3 (PCS)
+// block_min_idx: minimum (i,j,k) grid point index in block
+// block_num_idx: number of grid points in block (x,y,z)
+// project: whether to project to 2D
+// proj_plane: normal to projection plane (x,y,z)
+// grid_phys_mins: physical global min grid corner position (x,y,z)
+// grid_step_size: physical size of one grid space (x,y,z)
+// mass: mass of 1 particle
+// off_block: (output) grid points outside the block are appended
+// num_threads: number of threads
+//
+// side effects: writes density
+void IterateParticlesMas(DBlock* block,
+                         int order,
+                         int *block_min_idx,
+                         int *block_num_idx,
+                         bool project,
+                         float *proj_plane,
+                         float *grid_phys_mins,
+                         float *grid_step_size,
+                         float mass,
+                         vector<grid_pt_t>& off_block,
+                         dense_stats_t& stats,
+                         int num_threads)
+{
+  int n = block->num_orig_particles;
+  int np = order + 1;                     // grid points along each axis of a stencil
+  float *particles = block->particles;
+
+  // divisor for volume (3d density) or area (2d density)
+  // assumes projection is to x-y plane
+  float div = (project ? grid_step_size[0] * grid_step_size[1] :
+	       grid_step_size[0] * grid_step_size[1] * grid_step_size[2]);
+
+  // consistency check
+  stats.check_mass += n;
+  if (!n)
+    return;
+
+  // first grid z index of the stencil of each particle
+  vector<int> first_z(n);
+  {
+    float u[DENSE_MAS_BATCH], w[4 * DENSE_MAS_BATCH];
+    for (int p0 = 0; p0 < n; p0 += DENSE_MAS_BATCH)
+    {
+      int nb = min(DENSE_MAS_BATCH, n - p0);
+      for (int p = 0; p < nb; p++)
+        u[p] = (particles[3 * (p0 + p) + 2] - grid_phys_mins[2]) / grid_step_size[2];
+      MasWeights(order, u, nb, &first_z[p0], w);
+    }
+  }
+  int z_min = *min_element(first_z.begin(), first_z.end());
+  int z_max = *max_element(first_z.begin(), first_z.end()) + order;
+
+  // first z index of each thread's slab; the slabs of a tiled density field start at a tile,
+  // so that each tile is allocated and written by one thread; a projection adds every z
+  // slab to the same (x,y) grid points, so it runs in one thread
+  int nthreads = project ? 1 : max(1, min(num_threads, z_max - z_min + 1));
+  vector<int> slabs(nthreads + 1);
+  for (int s = 0; s <= nthreads; s++)
+  {
+    slabs[s] = z_min + (long)(z_max - z_min + 1) * s / nthreads;
+    int bz = slabs[s] - block_min_idx[2];
+    if (block->density_tiles && s > 0 && s < nthreads && bz > 0)
+      slabs[s] = min(z_max + 1, block_min_idx[2] + (bz + DENSE_TILE - 1) / DENSE_TILE * DENSE_TILE);
+  }
+
+  // particles whose stencils reach into each slab, in order
+  vector< vector<int> > slab_pts(nthreads);
+  for (int p = 0; p < n; p++)
+  {
+    int s = upper_bound(slabs.begin(), slabs.end(), first_z[p]) - slabs.begin() - 1;
+    for (; s < nthreads && slabs[s] <= first_z[p] + order; s++)
+      slab_pts[s].push_back(p);
+  }
+
+  vector< vector<grid_pt_t> > nbr_pts(nthreads); // grid points for the neighbors
+  vector<dense_stats_t> slab_stats(nthreads, dense_stats_t());
+  bool in_place = (!block->density_tiles && !project); // rows written directly in density
+
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
 #endif
+  for (int s = 0; s < nthreads; s++)
+  {
+    int s0 = slabs[s], s1 = slabs[s + 1] - 1;
+    const vector<int>& pts = slab_pts[s];
+    dense_stats_t& st = slab_stats[s];
+    float u[DENSE_MAS_BATCH];
+    int first[3][DENSE_MAS_BATCH];        // first grid index of the stencils (x,y,z)
+    float w[3][4 * DENSE_MAS_BATCH];      // weights along each axis (see MasWeights())
+
+    for (size_t b0 = 0; b0 < pts.size(); b0 += DENSE_MAS_BATCH)
+    {
+      int nb = min((size_t)DENSE_MAS_BATCH, pts.size() - b0);
+      for (int j = 0; j < 3; j++)
+      {
+        for (int p = 0; p < nb; p++)
+          u[p] = (particles[3 * pts[b0 + p] + j] - grid_phys_mins[j]) / grid_step_size[j];
+        MasWeights(order, u, nb, first[j], w[j]);
+      }
+
+      for (int p = 0; p < nb; p++)
+      {
+        int bx = first[0][p] - block_min_idx[0];
+        bool in_x = (bx >= 0 && bx + order < block_num_idx[0]);
+        int z0 = max(first[2][p], s0), z1 = min(first[2][p] + order, s1);
+        for (int zi = z0; zi <= z1; zi++)
+        {
+          float wz = mass * w[2][(zi - first[2][p]) * nb + p];
+          int bz = zi - block_min_idx[2];
+          for (int k = 0; k < np; k++)
+          {
+            int yi = first[1][p] + k;
+            int by = yi - block_min_idx[1];
+            float wyz = wz * w[1][k * nb + p];
+            bool in_row = (by >= 0 && by < block_num_idx[1] && bz >= 0 && bz < block_num_idx[2]);
+
+            // a row of the stencil inside the block
+            if (in_place && in_row && in_x)
+            {
+              float *d = &block->density[(bz * block_num_idx[1] + by) * block_num_idx[0] + bx];
+              for (int i = 0; i < np; i++)
+              {
+                float m = wyz * w[0][i * nb + p];
+                d[i] += (m / div);
+                st.tot_mass += m;
+                if (d[i] > st.max_dense)
+                  st.max_dense = d[i];
+              }
+              continue;
+            }
+
+            // or a row that straddles the block boundary, or of a tiled density
+            for (int i = 0; i < np; i++)
+            {
+              float m = wyz * w[0][i * nb + p];
+              int block_grid_idx[3] = { bx + i, by, bz };
+              if (in_row && bx + i >= 0 && bx + i < block_num_idx[0])
+              {
+                float *d = DensityPt(block, block_grid_idx, block_num_idx, project, proj_plane);
+                *d += (m / div);
+                st.tot_mass += m;
+                if (*d > st.max_dense)
+                  st.max_dense = *d;
+              }
+              else
+              {
+                grid_pt_t pt;
+                pt.idx[0] = first[0][p] + i;
+                pt.idx[1] = yi;
+                pt.idx[2] = zi;
+                pt.mass = m;
+                nbr_pts[s].push_back(pt);
+              }
+            }
+          } // y
+        } // z
+      } // particles
+    } // batches
+  } // slabs
+
+  // merge the stats and the grid points for the neighbors in the order of the slabs
+  for (int s = 0; s < nthreads; s++)
+  {
+    stats.tot_mass += slab_stats[s].tot_mass;
+    if (slab_stats[s].max_dense > stats.max_dense)
+      stats.max_dense = slab_stats[s].max_dense;
+    off_block.insert(off_block.end(), nbr_pts[s].begin(), nbr_pts[s].end());
+  }
+}
 
 // iterate over cells and assigns density to grid points
 //  to grid points within a window size of one grid space, ie, CIC for the
@@ -470,6 +1412,8 @@ void IterateCellsOMP(DBlock* block,
 //  Note that we are only using the site (original particle position)
 //   from the cell, ignoring rest of voronoi cell for CIC
 //
+//  single thread IterateParticlesMas() of order 1
+//
 // block: local block
 // block_min_idx: minimum (i,j,k) grid point index in block
 // block_num_idx: number of grid points in block (output) (x,y,z)
@@ -479,9 +1423,9 @@ void IterateCellsOMP(DBlock* block,
 // grid_step_size: physical size of one grid space (x,y,z)
 // eps: floating point error tolerance
 // mass: mass of 1 particle
-// cp: communication proxy
+// off_block: (output) grid points outside the block are appended
 //
-// side effects: writes density or sends to neighbors
+// side effects: writes density
 void IterateCellsCic(DBlock* block,
                      int *block_min_idx,
                      int *block_num_idx,
@@ -492,72 +1436,11 @@ void IterateCellsCic(DBlock* block,
 		     float *data_maxs,
                      float eps,
                      float mass,
-                     const diy::Master::ProxyWithLink& cp)
+                     vector<grid_pt_t>& off_block,
+                     dense_stats_t& stats)
 {
-  float grid_pos[3];                            // physical position of grid point
-  RCLink* l = dynamic_cast<RCLink*>(cp.link()); // link to block neighbors
-
-  // divisor for volume (3d density) or area (2d density)
-  // assumes projection is to x-y plane
-  float div = (project ? grid_step_size[0] * grid_step_size[1] :
-	       grid_step_size[0] * grid_step_size[1] * grid_step_size[2]);
-
-  // cells
-  for (int cell = 0; cell < block->num_orig_particles; cell++)
-  {
-    // consitency check
-    check_mass++;
-
-    // distribute mass at cell site to neighboring grid points
-    vector<int> grid_idxs; // grid idxs that get a fraction of the mass
-    vector<float> grid_masses; // mass given to each grid_idx
-
-    float *pt = &(block->particles[3 * cell]); // x,y,z of particle
-
-    DistributeScalarCIC(pt, mass, grid_idxs, grid_masses, grid_step_size, grid_phys_mins, eps);
-
-    assert((int)grid_idxs.size() / 3 == 8); // sanity
-
-    // (8) grid points for this cell site
-    for (int i = 0; i < (int)grid_idxs.size() / 3; i++)
-    {
-      idx2phys(&(grid_idxs[3 * i]), grid_pos, grid_step_size, grid_phys_mins);
-
-      // assign density to grid points in the block
-      if (grid_pos[0] >= block->bounds.min[0] &&
-	  grid_pos[0] <= block->bounds.max[0] &&
-	  grid_pos[1] >= block->bounds.min[1] &&
-	  grid_pos[1] <= block->bounds.max[1] &&
-	  grid_pos[2] >= block->bounds.min[2] &&
-          grid_pos[2] <= block->bounds.max[2])
-      {
-	// assign the density to the local block density array
-	int block_grid_idx[3]; // local block idx of grid point
-	Global2LocalIdx(&(grid_idxs[3 * i]), block_grid_idx, block_min_idx);
-	int idx = index(block_grid_idx, block_num_idx, project, proj_plane);
-	block->density[idx] += (grid_masses[i] / div);
-
-	// consistency checks and output stats
-	tot_mass += grid_masses[i];
-	if (block->density[idx] > max_dense)
-	  max_dense = block->density[idx];
-      }
-
-      // or send grid points to neighboring blocks
-      else
-      {
-	grid_pt_t grid_pt;
-	grid_pt.idx[0] = grid_idxs[3 * i];
-	grid_pt.idx[1] = grid_idxs[3 * i + 1];
-	grid_pt.idx[2] = grid_idxs[3 * i + 2];
-	grid_pt.mass = grid_masses[i];
-        set<int> dests; // destination neighbor edges for this point
-        in(*l, grid_pos, std::inserter(dests, dests.end()), block->data_bounds);
-        for (set<int>::iterator it = dests.begin(); it != dests.end(); it++)
-          cp.enqueue(l->target(*it), grid_pt);
-      }
-    } // (8) grid points for this cell site
-  } // cells
+  IterateParticlesMas(block, 1, block_min_idx, block_num_idx, project, proj_plane,
+                      grid_phys_mins, grid_step_size, mass, off_block, stats, 1);
 }
 
 // grid parameters of one local block
@@ -581,63 +1464,91 @@ void BlockGridParams(DBlock *dblock,
                      float *data_mins,
                      float *data_maxs,
                      int *glo_num_idx)
+{
+  BlockGridParams(dblock->bounds, block_min_idx, block_max_idx, block_num_idx, grid_phys_mins,
+                  grid_step_size, eps, data_mins, data_maxs, glo_num_idx);
+}
+
+// grid parameters of one block, given its bounds
+//
+// the grid points of the blocks do not overlap, so this also tells which block owns a grid point
+//
+// bounds: block extents (the local block or a neighbor)
+// block_min_idx: global grid idx of block minimum grid point (output) (i,j,k)
+// block_max_idx: global grid idx of block maximum grid point (output) (i,j,k)
+// block_num_idx: number of grid points in block (output) (i,j,k)
+// grid_phys_mins: physical min corner of global grid (x,y,z)
+// grid_step_size: physical size of one grid space (x,y,z)
+// eps: floating point error tolerance
+// data_mins, data_maxs: physical global data extents (x,y,z)
+// glo_num_idx: global grid size
+void BlockGridParams(const diy::ContinuousBounds& bounds,
+                     int *block_min_idx,
+                     int *block_max_idx,
+                     int *block_num_idx,
+		     float *grid_phys_mins,
+                     float *grid_step_size,
+                     float eps,
+                     float *data_mins,
+                     float *data_maxs,
+                     int *glo_num_idx)
 {
   float pos[3]; // temporary position (x,y,z)
+  float bmin[3] = { bounds.min[0], bounds.min[1], bounds.min[2] }; // block extents
+  float bmax[3] = { bounds.max[0], bounds.max[1], bounds.max[2] };
 
   // global grid index of block minimum grid point
-  phys2idx(&(dblock->bounds.min[0]), block_min_idx, grid_step_size, grid_phys_mins);
+  phys2idx(bmin, block_min_idx, grid_step_size, grid_phys_mins);
   idx2phys(block_min_idx, pos, grid_step_size, grid_phys_mins);
-  if (pos[0] < dblock->bounds.min[0])
+  if (pos[0] < bmin[0])
     block_min_idx[0]++;
-  if (pos[1] < dblock->bounds.min[1])
+  if (pos[1] < bmin[1])
     block_min_idx[1]++;
-  if (pos[2] < dblock->bounds.min[2])
+  if (pos[2] < bmin[2])
     block_min_idx[2]++;
   idx2phys(block_min_idx, pos, grid_step_size, grid_phys_mins); // double check adjusted position
-  assert(pos[0] >= dblock->bounds.min[0] && pos[1] >= dblock->bounds.min[1] &&
-	 pos[2] >= dblock->bounds.min[2]);
+  assert(pos[0] >= bmin[0] && pos[1] >= bmin[1] && pos[2] >= bmin[2]);
 
   // global grid index of block maximum grid point
-  phys2idx(&(dblock->bounds.max[0]), block_max_idx, grid_step_size, grid_phys_mins);
+  phys2idx(bmax, block_max_idx, grid_step_size, grid_phys_mins);
   idx2phys(block_max_idx, pos, grid_step_size, grid_phys_mins);
-  if (pos[0] + grid_step_size[0] <= dblock->bounds.max[0])
+  if (pos[0] + grid_step_size[0] <= bmax[0])
     block_max_idx[0]++;
-  if (pos[1] + grid_step_size[1] <= dblock->bounds.max[1])
+  if (pos[1] + grid_step_size[1] <= bmax[1])
     block_max_idx[1]++;
-  if (pos[2] + grid_step_size[2] <= dblock->bounds.max[2])
+  if (pos[2] + grid_step_size[2] <= bmax[2])
     block_max_idx[2]++;
   idx2phys(block_max_idx, pos, grid_step_size, grid_phys_mins); // double check adjusted position
-  assert(pos[0] <= dblock->bounds.max[0] && pos[1] <= dblock->bounds.max[1] &&
-	 pos[2] <= dblock->bounds.max[2]);
+  assert(pos[0] <= bmax[0] && pos[1] <= bmax[1] && pos[2] <= bmax[2]);
 
   // eliminate duplication at the maximum block border
   if (fabs(data_mins[0] + block_max_idx[0] * grid_step_size[0] -
-	   dblock->bounds.max[0]) < eps &&
-      fabs(dblock->bounds.max[0] - data_maxs[0]) > grid_step_size[0])
+	   bmax[0]) < eps &&
+      fabs(bmax[0] - data_maxs[0]) > grid_step_size[0])
     block_max_idx[0]--;
   if (fabs(data_mins[1] + block_max_idx[1] * grid_step_size[1] -
-      dblock->bounds.max[1]) < eps &&
-      fabs(dblock->bounds.max[1] - data_maxs[1]) > grid_step_size[1])
+      bmax[1]) < eps &&
+      fabs(bmax[1] - data_maxs[1]) > grid_step_size[1])
     block_max_idx[1]--;
   if (fabs(data_mins[2] + block_max_idx[2] * grid_step_size[2] -
-      dblock->bounds.max[2]) < eps &&
-      fabs(dblock->bounds.max[2] - data_maxs[2]) > grid_step_size[2])
+      bmax[2]) < eps &&
+      fabs(bmax[2] - data_maxs[2]) > grid_step_size[2])
     block_max_idx[2]--;
 
   // possibly extend minimum end of blacks at the minimum end of the domain
-  if (fabs(dblock->bounds.min[0] - data_mins[0]) < grid_step_size[0])
+  if (fabs(bmin[0] - data_mins[0]) < grid_step_size[0])
     block_min_idx[0] = 0;
-  if (fabs(dblock->bounds.min[1] - data_mins[1]) < grid_step_size[1])
+  if (fabs(bmin[1] - data_mins[1]) < grid_step_size[1])
     block_min_idx[1] = 0;
-  if (fabs(dblock->bounds.min[2] - data_mins[2]) < grid_step_size[2])
+  if (fabs(bmin[2] - data_mins[2]) < grid_step_size[2])
     block_min_idx[2] = 0;
 
   // possibly extend maximum end of blacks at the maximum end of the domain
-  if (fabs(dblock->bounds.max[0] - data_maxs[0]) < grid_step_size[0])
+  if (fabs(bmax[0] - data_maxs[0]) < grid_step_size[0])
     block_max_idx[0] = glo_num_idx[0] - 1;
-  if (fabs(dblock->bounds.max[1] - data_maxs[1]) < grid_step_size[1])
+  if (fabs(bmax[1] - data_maxs[1]) < grid_step_size[1])
     block_max_idx[1] = glo_num_idx[1] - 1;
-  if (fabs(dblock->bounds.max[2] - data_maxs[2]) < grid_step_size[2])
+  if (fabs(bmax[2] - data_maxs[2]) < grid_step_size[2])
     block_max_idx[2] = glo_num_idx[2] - 1;
 
   // compute number of grid points in local block
@@ -648,94 +1559,138 @@ void BlockGridParams(DBlock *dblock,
 
 // get cell bounds, face vertices, and normals for all cell faces
 //
-// dblock: one delaunay block
-// cell: current cell counter
+// mesh: Voronoi cells of one delaunay block, with face normals (see fill_voronoi_mesh())
+// c: cell in the mesh
+// spheres: circumspheres of the tets, i.e., the Voronoi vertices
 // cell_min, cell_max: cell bounds (output)
 // normals: face normals (nx_0,ny_0,nz_0,nx_1,ny_1,nz_1, ...) (output)
 // face_verts: vertex positions for each face (output)
-void CellBounds(DBlock *dblock,
-                int cell,
+void CellBounds(const voronoi_mesh_t& mesh,
+                int c,
+                const circumspheres_t& spheres,
                 float *cell_min,
                 float *cell_max,
 		vector<float> &normals,
 		vector <vector <float> > &face_verts)
 {
-  float n[3]; // face normal
-
-  // a tet containing the cell site
-  int t = dblock->vert_to_tet[cell];
-
-  // neighbor edges is a vector of (vertex u, tet of vertex u) pairs
-  // that neighbor vertex v
-  vector< pair<int, int> > nbrs;
-  bool finite = neighbor_edges(nbrs, cell, dblock->tets, t);
+  int first_face = mesh.cell_faces[c];
+  int num_faces = mesh.cell_faces[c + 1] - first_face;
 
   // infinte cells should have been filtered by the caller
-  assert(finite);
+  assert(num_faces);
 
-  // grow vectors to correct size, num_faces = nbrs.size()
-  normals.reserve(3 * (int)nbrs.size());
-  face_verts.resize((int)nbrs.size());
+  // grow vectors to correct size
+  normals.assign(mesh.normals.begin() + 3 * first_face,
+                 mesh.normals.begin() + 3 * (first_face + num_faces));
+  face_verts.resize(num_faces);
 
   // get cell bounds
-  for (int k = 0; k < (int)nbrs.size(); k++) // faces
+  for (int k = 0; k < num_faces; k++) // faces
   {
-    // get edge link
-    int u  = nbrs[k].first;
-    int ut = nbrs[k].second;
-    std::vector<int> edge_link;
-    fill_edge_link(edge_link, cell, u, ut, dblock->tets);
+    int f = first_face + k;
+    face_verts[k].reserve(3 * (mesh.face_verts[f + 1] - mesh.face_verts[f]));
 
-    for (int l = 0; l < (int)edge_link.size(); l++) // vertices
+    for (int l = mesh.face_verts[f]; l < mesh.face_verts[f + 1]; l++) // vertices
     {
-      face_verts[k].reserve(3 * (int)edge_link.size());
-
-      float vv[3]; // voronoi vertex position
-      circumcenter(vv, &(dblock->tets[edge_link[l]]), dblock->particles);
+      // voronoi vertex position
+      int t = mesh.verts[l];
+      float vv[3] = { spheres.x[t], spheres.y[t], spheres.z[t] };
       face_verts[k].push_back(vv[0]);
       face_verts[k].push_back(vv[1]);
       face_verts[k].push_back(vv[2]);
 
       // extrema for entire cell
-      if ((k == 0 && l == 0) || vv[0] < cell_min[0])
-	cell_min[0] = vv[0];
-      if ((k == 0 && l == 0) || vv[0] > cell_max[0])
-	cell_max[0] = vv[0];
-
-      if ((k == 0 && l == 0) || vv[1] < cell_min[1])
-	cell_min[1] = vv[1];
-      if ((k == 0 && l == 0) || vv[1] > cell_max[1])
-	cell_max[1] = vv[1];
-
-      if ((k == 0 && l == 0) || vv[2] < cell_min[2])
-	cell_min[2] = vv[2];
-      if ((k == 0 && l == 0) || vv[2] > cell_max[2])
-	cell_max[2] = vv[2];
+      bool first = (k == 0 && l == mesh.face_verts[f]);
+      for (int i = 0; i < 3; i++)
+      {
+        if (first || vv[i] < cell_min[i])
+          cell_min[i] = vv[i];
+        if (first || vv[i] > cell_max[i])
+          cell_max[i] = vv[i];
+      }
     } // vertices
+  } // faces
+}
+
+// write the tiled density field of one block, one layer of tiles at a time, with zeros for the
+// tiles without density
+//
+// collective: the same number of writes on all processes, num_layers for each block; blocks
+// with fewer layers and null blocks (dblock NULL) write 0 points
+//
+// fd: output file
+// dblock: local block or NULL
+// block_min_idx: global grid idx of block minimum grid point (i,j,k)
+// block_num_idx: number of grid points in block (i,j,k)
+// glo_num_idx: global number of grid points (i,j,k)
+// num_layers: number of layers of tiles to write
+// comm: communicator
+static void WriteTiles(MPI_File fd,
+                       DBlock* dblock,
+                       int *block_min_idx,
+                       int *block_num_idx,
+                       int *glo_num_idx,
+                       int num_layers,
+                       MPI_Comm comm)
+{
+  MPI_Status status;
+  int pts_written;
+  vector<float> slab; // one layer of tiles, all the grid points in x and y
 
-    // normal
-    NewellNormal(&(face_verts[k][0]), edge_link.size(), n);
-    // check sign of dot product of normal with vector from site
-    // to first face vertex to see if normal has correct direction
-    // want outward normal
-    float v[3];
-    v[0] = face_verts[k][0] - dblock->particles[3 * cell];
-    v[1] = face_verts[k][1] - dblock->particles[3 * cell + 1];
-    v[2] = face_verts[k][2] - dblock->particles[3 * cell + 2];
-    if (v[0] * n[0] + v[1] * n[1] + v[2] * n[2] < 0.0)
+  for (int layer = 0; layer < num_layers; layer++)
+  {
+    int z0 = layer * DENSE_TILE; // first z index of the layer in the block
+    if (!dblock || z0 >= block_num_idx[2])
     {
-      n[0] *= -1.0;
-      n[1] *= -1.0;
-      n[2] *= -1.0;
+      float unused;
+      MPI_File_set_view(fd, 0, MPI_FLOAT, MPI_FLOAT, (char *)"native", MPI_INFO_NULL);
+      MPI_File_write_all(fd, &unused, 0, MPI_FLOAT, &status);
+      continue;
     }
-    normals.push_back(n[0]);
-    normals.push_back(n[1]);
-    normals.push_back(n[2]);
-  } // faces
+
+    int nx = block_num_idx[0], ny = block_num_idx[1];
+    int nz = min(DENSE_TILE, block_num_idx[2] - z0);
+    slab.assign((size_t)nx * ny * nz, 0.0f);
+    int tiles_x = (nx + DENSE_TILE - 1) / DENSE_TILE;
+    int tiles_y = (ny + DENSE_TILE - 1) / DENSE_TILE;
+    for (int ty = 0; ty < tiles_y; ty++)
+      for (int tx = 0; tx < tiles_x; tx++)
+      {
+        float *tile = dblock->density_tiles[(layer * tiles_y + ty) * tiles_x + tx];
+        if (!tile)
+          continue;
+        int x0 = tx * DENSE_TILE, y0 = ty * DENSE_TILE;
+        int n = min(DENSE_TILE, nx - x0); // points of a tile row in the block
+        for (int z = 0; z < nz; z++)
+          for (int y = y0; y < min(y0 + DENSE_TILE, ny); y++)
+            memcpy(&slab[((size_t)z * ny + y) * nx + x0],
+                   &tile[(z * DENSE_TILE + y - y0) * DENSE_TILE], n * sizeof(float));
+      }
+
+    // reversed order intentional
+    int sizes[3] = { glo_num_idx[2], glo_num_idx[1], glo_num_idx[0] };
+    int subsizes[3] = { nz, ny, nx };
+    int starts[3] = { block_min_idx[2] + z0, block_min_idx[1], block_min_idx[0] };
+    MPI_Datatype dtype;
+    MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &dtype);
+    MPI_Type_commit(&dtype);
+    MPI_File_set_view(fd, 0, MPI_FLOAT, dtype, (char *)"native", MPI_INFO_NULL);
+
+    int num_pts = slab.size();
+    int errcode = MPI_File_write_all(fd, &slab[0], num_pts, MPI_FLOAT, &status);
+    if (errcode != MPI_SUCCESS)
+      handle_error(errcode, (char *)"MPI_File_write_all nonempty datatype", comm);
+    MPI_Get_count(&status, MPI_FLOAT, &pts_written);
+    assert(pts_written == num_pts);
+
+    MPI_Type_free(&dtype);
+  }
 }
 
 // write density grid
 //
+// tiled density fields (see dense()) are written a layer of tiles at a time (see WriteTiles())
+//
 // mblocks: max number of blocks in any process
 // tblocks: total (global) number of blocks
 // outfile: output file name
@@ -794,6 +1749,19 @@ void WriteGrid(int mblocks,
     ProjectGrid(tblocks, glo_num_idx, eps, data_mins, data_maxs,
                 grid_phys_mins, grid_step_size, master, assigner);
 
+  // layers of tiles in the thickest block if the density is tiled, 0 otherwise
+  int num_layers = 0;
+  for (int i = 0; i < nblocks; i++)
+  {
+    if (!dblocks[i]->density_tiles)
+      continue;
+    int block_min_idx[3], block_max_idx[3], block_num_idx[3];
+    BlockGridParams(dblocks[i], block_min_idx, block_max_idx, block_num_idx, grid_phys_mins,
+                    grid_step_size, eps, data_mins, data_maxs, glo_num_idx);
+    num_layers = max(num_layers, (block_num_idx[2] + DENSE_TILE - 1) / DENSE_TILE);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &num_layers, 1, MPI_INT, MPI_MAX, comm);
+
   // write
   for (int block = 0; block < mblocks; block++)
   {
@@ -808,6 +1776,13 @@ void WriteGrid(int mblocks,
       BlockGridParams(dblocks[block], block_min_idx, block_max_idx, block_num_idx, grid_phys_mins,
                       grid_step_size, eps, data_mins, data_maxs, glo_num_idx);
 
+      if (num_layers)
+      {
+        WriteTiles(fd, dblocks[block], block_min_idx, block_num_idx, glo_num_idx, num_layers,
+                   comm);
+        continue;
+      }
+
       if (project)
       {
 	// reversed order intentional
@@ -855,6 +1830,9 @@ void WriteGrid(int mblocks,
       MPI_Type_free(&dtype);
     }
 
+    else if (num_layers) // null block, tiled
+      WriteTiles(fd, NULL, NULL, NULL, glo_num_idx, num_layers, comm);
+
     else // null block
     {
       float unused;
@@ -1457,7 +2435,11 @@ int CellGridPts(float *cell_mins,
 }
 
 // finds interior grid points in cell and sets density at them
-// current version further improved by limiting y scan
+//
+// the cell is the intersection of the half-spaces behind its faces (the normals point out
+// of the cell), so the interior of each (y, z) scan line is one x interval, found by
+// intersecting the line with all the face planes; a grid point is interior if it is
+// within eps of the inside of every face
 //
 // cell_grid_pts: number of grid points covered by cell bounding box
 // cell_min_grid_idx: cell minimum grid point global index
@@ -1482,194 +2464,112 @@ int CellInteriorGridPts(int *cell_grid_pts,
                         float eps,
                         float mass)
 {
-  int num_grid_pts = 0; // current number of grid points interior to cell
+  int num_faces = (int)face_verts.size();
   int tot_num_grid_pts = 0; // total number of grid points interior to cell
-  float grid_pos[3]; // physical position of current grid point
-  int x_left = cell_grid_pts[0] / 2; // x index stepping left
-  int x_right = cell_grid_pts[0] / 2; // x index stepping right
-  int y_start = 0; // y index start
-  bool x_in_left, x_in_right; // pt inside cell while stepping left, right
-  int min_xi, max_xi; // min, max x index of border crossing
-  bool border_found = false; // found border intersection at current z
-  bool z_step_done = false; // this z step is done
+  int num_grid_pts; // current number of grid points interior to cell
+  int min_xi, max_xi; // min, max x index of the interior of a scan line
   int xi, yi, zi; // indices for x, y, z
-  int yj; // second, temporary index in y
-  int first_x = 0; // x index of border crossing at first y line in each z
 
-  int y_steps = 0; // see how many y_steps we ended up making
-
-  // find the border points of the cell
-
-  // z step
-  for (zi = 0; zi < cell_grid_pts[2]; zi++)
+  // the planes, split by the sign of their x component; on the line (x, y, z) the distance
+  // to plane k is nx_k * x + c_k, c_k = ny_k * y + nz_k * z + d_k
+  vector<float> nx, ny, nz, d; // planes with nx > 0, then nx < 0, then nx = 0
+  int num_pos = 0, num_neg = 0;
+  for (int pass = 0; pass < 3; pass++)
   {
-    grid_pos[2] = cell_min_grid_pos[2] + zi * grid_step_size[2];
-    border_found = false; // init
-    z_step_done = false;
-
-    // initialize (with min > max) unused y-scan lines
-    for (yj = 0; yj < y_start; yj++) // prior to start
+    for (int k = 0; k < num_faces; k++)
     {
-      border[2 * (zi * cell_grid_pts[1] + yj)]     = 1; // min
-      border[2 * (zi * cell_grid_pts[1] + yj) + 1] = 0; // max
+      float *n = &(normals[3 * k]);
+      if ((pass == 0 && n[0] > 0.0) || (pass == 1 && n[0] < 0.0) || (pass == 2 && n[0] == 0.0))
+      {
+        nx.push_back(n[0]);
+        ny.push_back(n[1]);
+        nz.push_back(n[2]);
+        d.push_back(-(n[0] * face_verts[k][0] + n[1] * face_verts[k][1] +
+                      n[2] * face_verts[k][2]));
+      }
     }
+    if (pass == 0)
+      num_pos = (int)nx.size();
+    if (pass == 1)
+      num_neg = (int)nx.size() - num_pos;
+  }
+  // faces without a normal (degenerate, NaN) never exclude a point and are not planes
+  int num_planes = (int)nx.size();
+  vector<float> c(num_planes); // c_k of the current scan line
+  float *pc = c.size() ? &c[0] : NULL;
+  const float *pnx = nx.size() ? &nx[0] : NULL;
+  const float *pny = ny.size() ? &ny[0] : NULL;
+  const float *pnz = nz.size() ? &nz[0] : NULL;
+  const float *pd = d.size() ? &d[0] : NULL;
 
-    // y step
-    // even though the upper loop bound is the full number of grid points,
-    // early termination will occur deep in the body of the loop when the
-    // number of x-intersections becomes 0
-    for (yi = y_start; yi < cell_grid_pts[1]; yi++)
+  float grid_pos[3]; // physical position of current grid point
+  for (zi = 0; zi < cell_grid_pts[2]; zi++)
+  {
+    grid_pos[2] = cell_min_grid_pos[2] + zi * grid_step_size[2];
+    for (yi = 0; yi < cell_grid_pts[1]; yi++)
     {
-      // debug
-      y_steps++;
-
       grid_pos[1] = cell_min_grid_pos[1] + yi * grid_step_size[1];
-
-      // init the x stepping
-      grid_pos[0] = cell_min_grid_pos[0] + x_left * grid_step_size[0];
-      grid_pos[1] = cell_min_grid_pos[1] + yi * grid_step_size[1];
-      grid_pos[2] = cell_min_grid_pos[2] + zi * grid_step_size[2];
-      if (PtInCell(grid_pos, normals, face_verts, eps))
+      int *bounds = &border[2 * (zi * cell_grid_pts[1] + yi)];
+      bounds[0] = 1; // min > max: no interior points
+      bounds[1] = 0;
+
+#pragma omp simd
+      for (int k = 0; k < num_planes; k++)
+        pc[k] = pny[k] * grid_pos[1] + pnz[k] * grid_pos[2] + pd[k];
+
+      // planes parallel to the line: all or nothing
+      bool empty = false;
+      for (int k = num_pos + num_neg; k < num_planes; k++)
+        if (pc[k] > eps)
+          empty = true;
+      if (empty)
+        continue;
+
+      // the line is inside plane k for x <= (eps - c_k) / nx_k if nx_k > 0, x >= if nx_k < 0
+      float hi = std::numeric_limits<float>::max();
+      float lo = -hi;
+#pragma omp simd reduction(min:hi)
+      for (int k = 0; k < num_pos; k++)
+        hi = std::min(hi, (eps - pc[k]) / pnx[k]);
+#pragma omp simd reduction(max:lo)
+      for (int k = num_pos; k < num_pos + num_neg; k++)
+        lo = std::max(lo, (eps - pc[k]) / pnx[k]);
+      if (lo > hi)
+        continue;
+
+      // grid points of the interval, one wider for the rounding, then shrunk to the
+      // points that pass the distance test
+      float x0 = cell_min_grid_pos[0];
+      float fmin = floorf((lo - x0) / grid_step_size[0]);
+      float fmax = ceilf((hi - x0) / grid_step_size[0]);
+      min_xi = fmin < 0.0 ? 0 : (fmin > cell_grid_pts[0] ? cell_grid_pts[0] : (int)fmin);
+      max_xi = fmax < 0.0 ? -1 :
+        (fmax > cell_grid_pts[0] - 1 ? cell_grid_pts[0] - 1 : (int)fmax);
+      for (; min_xi <= max_xi; min_xi++)
       {
-	x_in_left = true;
-	x_in_right = true;
+        grid_pos[0] = x0 + min_xi * grid_step_size[0];
+        for (xi = 0; xi < num_pos + num_neg; xi++)
+          if (pnx[xi] * grid_pos[0] + pc[xi] > eps)
+            break;
+        if (xi == num_pos + num_neg)
+          break;
       }
-      else
+      for (; max_xi >= min_xi; max_xi--)
       {
-	x_in_left = false;
-	x_in_right = false;
+        grid_pos[0] = x0 + max_xi * grid_step_size[0];
+        for (xi = 0; xi < num_pos + num_neg; xi++)
+          if (pnx[xi] * grid_pos[0] + pc[xi] > eps)
+            break;
+        if (xi == num_pos + num_neg)
+          break;
       }
-      min_xi = cell_grid_pts[0] - 1;
-      max_xi = 0;
-
-      // x step left
-      for (xi = x_left; xi >= 0 && xi < cell_grid_pts[0];)
-      {
-	grid_pos[0] = cell_min_grid_pos[0] + xi * grid_step_size[0];
-	if (PtInCell(grid_pos, normals, face_verts, eps))
-        {
-	  if (x_in_left) // remains interior, keep stepping
-          {
-	    if (xi < min_xi)
-	      min_xi = xi;
-	    if (xi > max_xi)
-	      max_xi = xi;
-	    xi--;
-	  }
-	  else // edge crossing from interior to exterior
-          {
-	    if (xi < min_xi)
-	      min_xi = xi;
-	    if (xi > max_xi)
-	      max_xi = xi;
-	    x_left = xi;
-	    break;
-	  }
-	} // pt is inside the cell
-
-	// pt is outside the cell
-	else
-        {
-	  if (!x_in_left) // remains exterior, keep stepping
-	    xi++;
-	  else // edge crossing from exterior to interior
-          {
-	    x_left = xi;
-	    break;
-	  }
-	} // pt is outside the cell
-      } // x step left
-
-      // x step right
-      for (xi = x_right; xi >= 0 && xi < cell_grid_pts[0];)
-      {
-	grid_pos[0] = cell_min_grid_pos[0] + xi * grid_step_size[0];
-	if (PtInCell(grid_pos, normals, face_verts, eps))
-        {
-	  if (x_in_right) // remains interior, keep stepping
-          {
-	    if (xi < min_xi)
-	      min_xi = xi;
-	    if (xi > max_xi)
-	      max_xi = xi;
-	    xi++;
-	  }
-	  else // edge crossing from interior to exterior
-          {
-	    if (xi < min_xi)
-	      min_xi = xi;
-	    if (xi > max_xi)
-	      max_xi = xi;
-	    x_right = xi;
-	    break;
-	  }
-	} // pt is inside the cell
-
-	// pt is outside the cell
-	else
-        {
-	  if (!x_in_right) // remains exterior, keep stepping
-	    xi--;
-	  else // edge crossing from exterior to interior
-          {
-	    x_right = xi;
-	    break;
-	  }
-	} // pt is outside the cell
-      } // x step right
-
-      border[2 * (zi * cell_grid_pts[1] + yi)]     = min_xi;
-      border[2 * (zi * cell_grid_pts[1] + yi) + 1] = max_xi;
 
       // min_xi > max_xi is the signal that no points were found
-
-      // intersection found in this y-scan line
       if (min_xi <= max_xi)
       {
-	tot_num_grid_pts += (max_xi - min_xi + 1);
-	if (yi == y_start)
-	  first_x = (min_xi + max_xi) / 2;
-      }
-
-      // note the first y line with an intersection in this z step
-      int first_y; // y line with first border points
-      first_y = y_start; // initial values change nothing unless reset below
-      if (min_xi <= max_xi && !border_found)
-      {
-	first_y = yi;
-	border_found = true;
-      }
-
-      if (min_xi > max_xi && border_found)
-	z_step_done = true;
-
-      // when this z step is done and if there are more z steps to do,
-      // check if y_start needs to be loosened for next z step
-      if ((yi == cell_grid_pts[1] - 1 || z_step_done)
-	  && zi + 1 < cell_grid_pts[2])
-      {
-	grid_pos[2] = cell_min_grid_pos[2] + (zi + 1) * grid_step_size[2];
-	grid_pos[0] = cell_min_grid_pos[0] + first_x * grid_step_size[0];
-	for (yj = first_y; yj > 0; yj--)
-        {
-	  grid_pos[1] = cell_min_grid_pos[1] + yj * grid_step_size[1];
-	  if (!PtInCell(grid_pos, normals, face_verts, eps))
-	    break;
-	}
-	y_start = yj;
-      } // loosen y start
-
-      // terminate the yi loop (this z step) early if it is done
-      // also initialize the borders of unused y-scan lines skipped at the end
-      if (z_step_done)
-      {
-	for (yj = yi + 1; yj < cell_grid_pts[1]; yj++) // after end
-        {
-	  border[2 * (zi * cell_grid_pts[1] + yj)]     = 1; // min
-	  border[2 * (zi * cell_grid_pts[1] + yj) + 1] = 0; // max
-	}
-
-	break; // y step
+        bounds[0] = min_xi;
+        bounds[1] = max_xi;
+        tot_num_grid_pts += (max_xi - min_xi + 1);
       }
     } // y step
   } // z step
@@ -0,0 +1,214 @@
+#include <cmath>
+#include <algorithm>
+
+#include "tess/locate.h"
+#include "tess/tet.hpp"
+
+/**
+ * builds the grid of starting sites, about one particle per cell; an empty cell takes
+ * the site of the nearest nonempty cell before it in memory order (or after it)
+ *
+ * grid:	output
+ * particles:	array of particles (x1,y1,z1,x2,y2,z2,...)
+ * num_particles: number of particles
+ * vert_to_tet:	a tet containing each particle, -1 if none; only particles in tets are sites
+ */
+void fill_locate_grid(locate_grid_t&    grid,
+                      float*            particles,
+                      int               num_particles,
+                      const int*        vert_to_tet)
+{
+    float max[3];
+    for (int j = 0; j < 3; ++j)
+    {
+        grid.min[j] = num_particles ? particles[j] : 0;
+        max[j]      = grid.min[j];
+    }
+    for (int p = 1; p < num_particles; ++p)
+        for (int j = 0; j < 3; ++j)
+        {
+            grid.min[j] = std::min(grid.min[j], particles[3 * p + j]);
+            max[j]      = std::max(max[j], particles[3 * p + j]);
+        }
+
+    int n = std::max(1, (int)cbrt((double)num_particles));
+    for (int j = 0; j < 3; ++j)
+    {
+        grid.dims[j]  = n;
+        grid.scale[j] = max[j] > grid.min[j] ? n / (max[j] - grid.min[j]) : 0;
+    }
+
+    grid.sites.assign(n * n * n, -1);
+    for (int p = 0; p < num_particles; ++p)
+    {
+        if (vert_to_tet[p] == -1)
+            continue;
+        int c[3];
+        for (int j = 0; j < 3; ++j)
+            c[j] = std::min(n - 1, (int)((particles[3 * p + j] - grid.min[j]) * grid.scale[j]));
+        grid.sites[(c[2] * n + c[1]) * n + c[0]] = p;
+    }
+
+    // fill the empty cells
+    int last = -1;
+    for (size_t i = 0; i < grid.sites.size(); ++i)
+        if (grid.sites[i] == -1)
+            grid.sites[i] = last;
+        else
+            last = grid.sites[i];
+    last = -1;
+    for (size_t i = grid.sites.size(); i-- > 0; )
+        if (grid.sites[i] == -1)
+            grid.sites[i] = last;
+        else
+            last = grid.sites[i];
+}
+
+/**
+ * finds the tet containing q by a visibility walk from tet t: steps into the neighbor
+ * across any face that separates the current tet from q
+ *
+ * returns the containing tet, -1 if q lies outside the convex hull (or the walk failed to
+ * end in num_tets steps, which only degenerate input can cause)
+ */
+int locate_tet(const float*     q,
+               int              t,
+               tet_t*           tets,
+               int              num_tets,
+               float*           particles)
+{
+    float x[3] = { q[0], q[1], q[2] };
+
+    for (int step = 0; t != -1 && step <= num_tets; ++step)
+    {
+        int i;
+        for (i = 0; i < 4; ++i)
+        {
+            // rotate the first face tested, so that ties do not send the walk in circles
+            int f = (i + step) % 4;
+            float *a = &particles[3 * tets[t].verts[(f + 1) % 4]],
+                *b = &particles[3 * tets[t].verts[(f + 2) % 4]],
+                *c = &particles[3 * tets[t].verts[(f + 3) % 4]],
+                *d = &particles[3 * tets[t].verts[f]];
+
+            float ab[3], ac[3], n[3];
+            for (int j = 0; j < 3; ++j)
+            {
+                ab[j] = b[j] - a[j];
+                ac[j] = c[j] - a[j];
+            }
+            cross(n, ab, ac);
+
+            // q and the opposite vertex on different sides of the face
+            if (dot(n, x, a) * dot(n, d, a) < 0)
+            {
+                t = tets[t].tets[f];
+                break;
+            }
+        }
+        if (i == 4)
+            return t;
+    }
+
+    return -1;
+}
+
+/**
+ * finds the site nearest to q by a greedy walk along the Delaunay edges from vertex v
+ * (on a Delaunay graph the walk cannot get stuck before the nearest site)
+ */
+int nearest_site(const float*           q,
+                 int                    v,
+                 tet_t*                 tets,
+                 const vert_stars_t&    stars,
+                 float*                 particles)
+{
+    float x[3] = { q[0], q[1], q[2] };
+    float dist = distance(x, &particles[3 * v]);
+
+    while (true)
+    {
+        int best = v;
+        for (int k = stars.offsets[v]; k < stars.offsets[v + 1]; ++k)
+        {
+            const tet_t& tet = tets[stars.tets[k]];
+            for (int i = 0; i < 4; ++i)
+            {
+                float d = distance(x, &particles[3 * tet.verts[i]]);
+                if (d < dist)
+                {
+                    dist = d;
+                    best = tet.verts[i];
+                }
+            }
+        }
+        if (best == v)
+            return v;
+        v = best;
+    }
+}
+
+/**
+ * locates a batch of query positions: the containing tet and the nearest site of each
+ *
+ * tets_out:	output, containing tet of each query, -1 outside the convex hull
+ * sites_out:	output, nearest site of each query, -1 if there are no sites
+ * queries:	query positions (x1,y1,z1,x2,y2,z2,...)
+ * num_queries:	number of queries
+ * tets:	array of all tetrahedra
+ * num_tets:	number of tetrahedra
+ * vert_to_tet:	a tet containing each particle
+ * stars:	stars of the vertices (see fill_vert_stars())
+ * particles:	array of particles (x1,y1,z1,x2,y2,z2,...)
+ * grid:	starting sites (see fill_locate_grid())
+ * num_threads:	threads sharing the queries
+ */
+void locate(int*                        tets_out,
+            int*                        sites_out,
+            const float*                queries,
+            int                         num_queries,
+            tet_t*                      tets,
+            int                         num_tets,
+            const int*                  vert_to_tet,
+            const vert_stars_t&         stars,
+            float*                      particles,
+            const locate_grid_t&        grid,
+            int                         num_threads)
+{
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for schedule(dynamic, 256) num_threads(num_threads)
+#endif
+    for (int i = 0; i < num_queries; ++i)
+    {
+        const float* q = &queries[3 * i];
+
+        // starting site from the grid
+        int c[3];
+        for (int j = 0; j < 3; ++j)
+        {
+            c[j] = (int)((q[j] - grid.min[j]) * grid.scale[j]);
+            c[j] = std::max(0, std::min(grid.dims[j] - 1, c[j]));
+        }
+        int s = grid.sites[(c[2] * grid.dims[1] + c[1]) * grid.dims[0] + c[0]];
+        if (s == -1)
+        {
+            tets_out[i]  = -1;
+            sites_out[i] = -1;
+            continue;
+        }
+
+        int t = locate_tet(q, vert_to_tet[s], tets, num_tets, particles);
+        tets_out[i] = t;
+
+        // the nearest vertex of the containing tet is close to the nearest site
+        if (t != -1)
+        {
+            float x[3] = { q[0], q[1], q[2] };
+            for (int j = 0; j < 4; ++j)
+                if (distance(x, &particles[3 * tets[t].verts[j]]) <
+                    distance(x, &particles[3 * s]))
+                    s = tets[t].verts[j];
+        }
+        sites_out[i] = nearest_site(q, s, tets, stars, particles);
+    }
+}
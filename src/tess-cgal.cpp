@@ -3,6 +3,12 @@
 #include "tess/tet-neighbors.h"
 #include <vector>
 
+#ifdef TESS_CGAL_PARALLEL
+#include <tbb/task_arena.h>
+
+#define TESS_CGAL_LOCK_CELLS 50     // lock grid resolution per dimension
+#endif
+
 //----------------------------------------------------------------------------
 // Initialize and destroy Delaunay data structures used by CGAL.
 // We keep them persistent for later incremental insertion of additional points.
@@ -22,15 +28,17 @@ void clean_delaunay_data_structure(dblock_t* b)
 //  creates local delaunay cells in one block
 //
 //  b: local block
+//  num_threads: threads for inserting the particles (only with TESS_CGAL_PARALLEL)
 //
-void local_cells(struct dblock_t *b)
+void local_cells(struct dblock_t *b, int num_threads)
 {
   Delaunay3D* d = (Delaunay3D*)b->Dt;
-  construct_delaunay(*d, b->num_particles, b->particles);
+  construct_delaunay(*d, b->num_particles, b->particles, num_threads);
   int ntets =  d->number_of_finite_cells();
   b->num_tets = ntets;
-  b->tets = (struct tet_t*)malloc(ntets * sizeof(struct tet_t));
+  reserve_tets(b, ntets);
   gen_tets(*d, b->tets);
+  b->num_changed_tets = -1;   // gen_tets() renumbers all the tets
   fill_vert_to_tet(b);
 }
 //----------------------------------------------------------------------------
@@ -67,10 +75,49 @@ int gen_delaunay_output(Delaunay3D &Dt, int** tet_verts) {
 //
 //    compute Delaunay
 //
-void construct_delaunay(Delaunay3D &Dt, int num_particles, float *particles)
+//    num_threads > 1 inserts the new points in parallel; the resulting triangulation
+//    is the same, only the order of its cells can differ
+//
+void construct_delaunay(Delaunay3D &Dt, int num_particles, float *particles,
+                        int num_threads)
 {
   int n = Dt.number_of_vertices();
 
+#ifdef TESS_CGAL_PARALLEL
+  if (num_threads > 1 && num_particles > n)
+  {
+    std::vector< std::pair<Point,unsigned> > points; points.reserve(num_particles - n);
+    float min[3], max[3];
+    for (int k = 0; k < 3; k++)
+    {
+      min[k] = particles[k];
+      max[k] = particles[k];
+    }
+    for (unsigned j = 0; j < (unsigned)num_particles; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        if (particles[3*j+k] < min[k]) min[k] = particles[3*j+k];
+        if (particles[3*j+k] > max[k]) max[k] = particles[3*j+k];
+      }
+      if (j >= (unsigned)n)
+        points.push_back(std::make_pair(Point(particles[3*j],
+                                              particles[3*j+1],
+                                              particles[3*j+2]), j));
+    }
+
+    // the lock grid only lives for this insertion
+    Delaunay3D::Lock_data_structure locks(CGAL::Bbox_3(min[0], min[1], min[2],
+                                                       max[0], max[1], max[2]),
+                                          TESS_CGAL_LOCK_CELLS);
+    Dt.set_lock_data_structure(&locks);
+    tbb::task_arena arena(num_threads);
+    arena.execute([&]() { Dt.insert(points.begin(), points.end()); });
+    Dt.set_lock_data_structure(0);
+    return;
+  }
+#endif
+
 #ifdef TESS_CGAL_ALLOW_SPATIAL_SORT
   std::vector< std::pair<Point,unsigned> > points; points.reserve(num_particles);
   for (unsigned j = n; j < (unsigned)num_particles; j++)
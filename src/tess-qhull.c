@@ -1,27 +1,125 @@
 #include "tess/tess-qhull.h"
 #include "tess/tess.h"
 #include <assert.h>
+#include <string.h>
+#ifndef DIY_NO_THREADS
+#include <pthread.h>
+#endif
 
+/* tolerances for the incremental update; both err on the side of retriangulating
+   more than necessary */
+#define QH_INSPHERE_TOL   1e-6  /* relative tolerance of the circumsphere test */
+#define QH_VISIBLE_TOL    1e-6  /* relative tolerance of the hull facet visibility test */
+#define QH_MAX_INSERT     0.5   /* max fraction of new particles updated incrementally */
+
+#define TET_CONFLICT      0x01  /* tet circumsphere contains a new particle */
+#define TET_HOLE          0x20  /* removed tet slot not refilled */
+#define TET_VISIBLE(i)    (0x02 << (i)) /* hull facet opposite vertex i is visible */
+
+#define HULL_NODE(t, i)   (-(4 * (t) + (i)) - 1)
+#define HULL_TET(n)       ((-(n) - 1) >> 2)
+#define HULL_FACE(n)      ((-(n) - 1) & 3)
+
+#ifndef DIY_NO_THREADS
+/* qhull keeps its state in a global, so diy threads take turns running it */
+static pthread_mutex_t qhull_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* growable array of ints */
+struct ivec_t {
+  int *a;
+  int n, cap;
+};
+
+/* facet of a kept tet on the boundary of the retriangulated region */
+struct reg_face_t {
+  int tet, face;               /* kept tet and its facet */
+  int required;                /* facet borders a removed tet (else a visible hull facet) */
+  int k_sub;                   /* the kept tet in the local triangulation */
+  int r_sub, r_face;           /* the new tet across the facet in the local triangulation */
+};
+
+static void ivec_push(struct ivec_t *v, int x)
+{
+  if (v->n == v->cap) {
+    v->cap = v->cap ? 2 * v->cap : 64;
+    v->a = (int *)realloc(v->a, v->cap * sizeof(int));
+  }
+  v->a[v->n++] = x;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+/*--------------------------------------------------------------------------*/
+/*
+  grows the per-tet and per-vertex arrays of the persistent state
+*/
+static void reserve_state(struct qhull_dt_t *dt, int num_tets, int num_verts)
+{
+  int n;
+
+  if (num_tets > dt->max_tets) {
+    n = dt->max_tets;
+    dt->max_tets = num_tets + num_tets / 4;
+    dt->tets = (struct tet_t *)realloc(dt->tets, dt->max_tets * sizeof(struct tet_t));
+    dt->flags = (unsigned char *)realloc(dt->flags, dt->max_tets);
+    dt->hull_seen = (unsigned char *)realloc(dt->hull_seen, dt->max_tets);
+    dt->stamp = (int *)realloc(dt->stamp, dt->max_tets * sizeof(int));
+    dt->hull_stamp = (int *)realloc(dt->hull_stamp, dt->max_tets * sizeof(int));
+    memset(dt->flags + n, 0, dt->max_tets - n);
+    memset(dt->stamp + n, 0, (dt->max_tets - n) * sizeof(int));
+    memset(dt->hull_stamp + n, 0, (dt->max_tets - n) * sizeof(int));
+  }
+
+  if (num_verts > dt->max_verts) {
+    n = dt->max_verts;
+    dt->max_verts = num_verts + num_verts / 4;
+    dt->vert_to_tet = (int *)realloc(dt->vert_to_tet, dt->max_verts * sizeof(int));
+    dt->vert_stamp = (int *)realloc(dt->vert_stamp, dt->max_verts * sizeof(int));
+    memset(dt->vert_stamp + n, 0, (dt->max_verts - n) * sizeof(int));
+  }
+}
 /*--------------------------------------------------------------------------*/
-/* Initialization and destruction of Delaunay data structures is not used with
- * qhull, since it doesn't support incremental updates.
- */
+/*
+  Initialization and destruction of the persistent qhull state; qhull itself
+  does not support incremental updates, so we keep the previous triangulation
+  and retriangulate only the part affected by newly received particles.
+*/
 void init_delaunay_data_structure(struct dblock_t* b)
 {
-  b->Dt = NULL;
+  b->Dt = calloc(1, sizeof(struct qhull_dt_t));
 }
 
 void clean_delaunay_data_structure(struct dblock_t* b)
 {
+  struct qhull_dt_t *dt = (struct qhull_dt_t *)b->Dt;
+
+  if (dt) {
+    free(dt->tets);
+    free(dt->vert_to_tet);
+    free(dt->flags);
+    free(dt->hull_seen);
+    free(dt->stamp);
+    free(dt->hull_stamp);
+    free(dt->vert_stamp);
+    free(dt);
+  }
   b->Dt = NULL;
 }
 /*--------------------------------------------------------------------------*/
 /*
-  creates local delaunay cells
+  runs qhull on a set of points and stores the resulting tets (with neighbors
+  ordered opposite to vertices) in dblock
 
-  dblock: local block
+  num_threads: threads for reordering the neighbors (qhull itself is serial)
+
+  returns qhull exit code
 */
-void local_cells(struct dblock_t *dblock)
+static int run_qhull(int num_pts, double *pts, struct dblock_t *dblock,
+                     int num_threads)
 {
   boolT ismalloc = False;    /* True if qhull should free points in
 				qh_freeqhull() or reallocation */
@@ -29,38 +127,27 @@ void local_cells(struct dblock_t *dblock)
   int exitcode;             /* 0 if no error from qhull */
   int curlong, totlong;     /* memory remaining after qh_memfreeshort */
   FILE *dev_null; /* file descriptor for writing to /dev/null */
-  int i, j;
   int dim = 3; /* 3d */
 
   dev_null = fopen("/dev/null", "w");
   assert(dev_null != NULL);
 
-  /* deep copy from float to double (qhull API is double) */
-  double *pts =
-    (double *)malloc(dblock->num_particles * 3 * sizeof(double));
-  for (j = 0; j < 3 * dblock->num_particles; j++)
-    pts[j] = dblock->particles[j];
+#ifndef DIY_NO_THREADS
+  pthread_mutex_lock(&qhull_mutex);
+#endif
 
   /* compute delaunay */
   /*     sprintf(flags, "qhull v d o Fv Fo"); /\* Fv prints voronoi faces *\/ */
   sprintf (flags, "qhull d Qt"); /* print delaunay cells */
 
   /* eat qhull output by sending it to dev/null */
-  exitcode = qh_new_qhull(dim, dblock->num_particles, pts, ismalloc,
+  exitcode = qh_new_qhull(dim, num_pts, pts, ismalloc,
                           flags, dev_null, stderr);
 
-  free(pts);
-
   /* process delaunay output */
   if (!exitcode)
     gen_delaunay_output(qh facet_list, dblock);
 
-  /* qhull does not order verts and neighbor tets such that the ith
-     neighbor is opposite the ith vertex; so need to reorder neighbors */
-  reorder_neighbors(dblock);
-
-  fill_vert_to_tet(dblock);
-
   /* clean up qhull */
   qh_freeqhull(!qh_ALL);                 /* free long memory */
   qh_memfreeshort(&curlong, &totlong);  /* free short memory */
@@ -68,8 +155,741 @@ void local_cells(struct dblock_t *dblock)
     fprintf (stderr, "qhull internal warning: did not free %d bytes of "
              "long memory (%d pieces)\n", totlong, curlong);
 
+#ifndef DIY_NO_THREADS
+  pthread_mutex_unlock(&qhull_mutex);
+#endif
+
+  /* qhull does not order verts and neighbor tets such that the ith
+     neighbor is opposite the ith vertex; so need to reorder neighbors */
+  reorder_neighbors(dblock, num_threads);
+
   fclose(dev_null);
 
+  return exitcode;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  orientation of d with respect to the plane through a, b, c
+  (6 times the signed volume of tet abcd)
+*/
+static double orient(const float *a, const float *b, const float *c, const float *d)
+{
+  double ab[3], ac[3], ad[3];
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    ab[i] = (double)b[i] - a[i];
+    ac[i] = (double)c[i] - a[i];
+    ad[i] = (double)d[i] - a[i];
+  }
+  return ab[0] * (ac[1] * ad[2] - ac[2] * ad[1]) -
+         ab[1] * (ac[0] * ad[2] - ac[2] * ad[0]) +
+         ab[2] * (ac[0] * ad[1] - ac[1] * ad[0]);
+}
+/*--------------------------------------------------------------------------*/
+/*
+  whether q lies inside (or, within tolerance, on) the circumsphere of a tet;
+  degenerate tets are always reported in conflict
+*/
+static int in_conflict(const float *particles, const struct tet_t *tet, const float *q)
+{
+  const float *a = &particles[3 * tet->verts[0]];
+  double u[3][3], l[3], c[3], den, r2, d2;
+  int i, j;
+
+  for (i = 0; i < 3; i++) {
+    l[i] = 0.0;
+    for (j = 0; j < 3; j++) {
+      u[i][j] = (double)particles[3 * tet->verts[i + 1] + j] - a[j];
+      l[i] += u[i][j] * u[i][j];
+    }
+  }
+
+  den = 2.0 * (u[0][0] * (u[1][1] * u[2][2] - u[1][2] * u[2][1]) -
+               u[0][1] * (u[1][0] * u[2][2] - u[1][2] * u[2][0]) +
+               u[0][2] * (u[1][0] * u[2][1] - u[1][1] * u[2][0]));
+  if (den == 0.0)
+    return 1;
+
+  /* circumcenter relative to a */
+  for (j = 0; j < 3; j++) {
+    int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+    c[j] = (l[0] * (u[1][j1] * u[2][j2] - u[1][j2] * u[2][j1]) +
+            l[1] * (u[2][j1] * u[0][j2] - u[2][j2] * u[0][j1]) +
+            l[2] * (u[0][j1] * u[1][j2] - u[0][j2] * u[1][j1])) / den;
+  }
+
+  r2 = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+  d2 = 0.0;
+  for (j = 0; j < 3; j++)
+    d2 += ((double)q[j] - a[j] - c[j]) * ((double)q[j] - a[j] - c[j]);
+
+  return d2 <= r2 * (1.0 + QH_INSPHERE_TOL);
+}
+/*--------------------------------------------------------------------------*/
+/*
+  whether q lies on the outer side of (or, within tolerance, on) the hull
+  facet opposite vertex i of a tet
+*/
+static int hull_visible(const float *particles, const struct tet_t *tet, int i,
+                        const float *q)
+{
+  const float *a = &particles[3 * tet->verts[(i + 1) % 4]];
+  const float *b = &particles[3 * tet->verts[(i + 2) % 4]];
+  const float *c = &particles[3 * tet->verts[(i + 3) % 4]];
+  const float *d = &particles[3 * tet->verts[i]];
+  double n[3], qa[3], sd, sq, nn, qq;
+  int j;
+
+  sd = orient(a, b, c, d);
+  sq = orient(a, b, c, q);
+  if (sd == 0.0)
+    return 1;
+  if (sd < 0.0)
+    sq = -sq;
+  if (sq <= 0.0)
+    return 1;
+
+  /* q is on the inner side; visible only if it is close to the plane */
+  for (j = 0; j < 3; j++) {
+    int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+    n[j] = ((double)b[j1] - a[j1]) * ((double)c[j2] - a[j2]) -
+           ((double)b[j2] - a[j2]) * ((double)c[j1] - a[j1]);
+    qa[j] = (double)q[j] - a[j];
+  }
+  nn = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+  qq = qa[0] * qa[0] + qa[1] * qa[1] + qa[2] * qa[2];
+
+  return sq * sq <= QH_VISIBLE_TOL * QH_VISIBLE_TOL * nn * qq;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  visibility walk from tet t towards q
+
+  returns the tet containing q (face = -1) or a tet with a hull facet
+  visible from q (face = index of the facet), or -1 if the walk fails
+*/
+static int locate(const struct qhull_dt_t *dt, const float *particles,
+                  const float *q, int t, int *face)
+{
+  const struct tet_t *tet;
+  const float *a, *b, *c, *d;
+  double sd, sq;
+  int steps, k, i;
+
+  for (steps = 0; steps <= dt->num_tets; steps++) {
+    tet = &dt->tets[t];
+
+    /* rotate the starting facet to avoid cycling */
+    for (k = 0; k < 4; k++) {
+      i = (k + steps) & 3;
+      a = &particles[3 * tet->verts[(i + 1) % 4]];
+      b = &particles[3 * tet->verts[(i + 2) % 4]];
+      c = &particles[3 * tet->verts[(i + 3) % 4]];
+      d = &particles[3 * tet->verts[i]];
+      sd = orient(a, b, c, d);
+      sq = orient(a, b, c, q);
+      if ((sd > 0.0 && sq < 0.0) || (sd < 0.0 && sq > 0.0))
+        break;
+    }
+
+    if (k == 4) {
+      *face = -1;
+      return t;
+    }
+    if (tet->tets[i] < 0) {
+      *face = i;
+      return t;
+    }
+    t = tet->tets[i];
+  }
+
+  return -1;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  rotates around edge (a, b) of the hull facet opposite vertex i of tet t
+  to find the adjacent hull facet
+
+  returns its tet (facet index in face) or -1 on failure
+*/
+static int hull_neighbor(const struct qhull_dt_t *dt, int t, int i, int a, int b,
+                         int *face)
+{
+  const struct tet_t *tet;
+  int k, m, v, steps;
+
+  *face = -1;
+
+  /* third vertex of the facet we came through */
+  for (v = 0; v < 4; v++) {
+    k = dt->tets[t].verts[v];
+    if (v != i && k != a && k != b)
+      break;
+  }
+
+  for (steps = 0; steps < dt->num_tets; steps++) {
+    tet = &dt->tets[t];
+
+    /* other facet of t around the edge is opposite k and contains m */
+    m = -1;
+    for (v = 0; v < 4; v++) {
+      if (tet->verts[v] == k)
+        *face = v;
+      else if (tet->verts[v] != a && tet->verts[v] != b)
+        m = tet->verts[v];
+    }
+    if (m < 0 || *face < 0)
+      return -1;
+
+    if (tet->tets[*face] < 0)
+      return t;
+
+    t = tet->tets[*face];
+    k = m;
+  }
+
+  return -1;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  marks the hull facet opposite vertex i of tet t as visited for the current
+  stamp
+
+  returns 1 if it was visited already
+*/
+static int hull_seen(struct qhull_dt_t *dt, int t, int i)
+{
+  if (dt->hull_stamp[t] != dt->cur_stamp) {
+    dt->hull_stamp[t] = dt->cur_stamp;
+    dt->hull_seen[t] = 0;
+  }
+  if (dt->hull_seen[t] & (1 << i))
+    return 1;
+  dt->hull_seen[t] |= (1 << i);
+  return 0;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  flags the tets whose circumspheres contain the particles [first, last) and
+  the hull facets visible from them; the conflict region of one particle is
+  connected once the hull facets are included, so it is found by a breadth-first
+  search from the tet located by a walk
+
+  touched: tets with flags set
+  conflicts: tets in conflict
+
+  returns 0 on success
+*/
+static int find_conflicts(struct qhull_dt_t *dt, const float *particles,
+                          int first, int last,
+                          struct ivec_t *touched, struct ivec_t *conflicts)
+{
+  struct ivec_t queue = { NULL, 0, 0 };
+  const struct tet_t *tet;
+  const float *q;
+  int p, k, t, i, e, n, nf, face, verts[3];
+  int start = 0;
+  int ret = 1;
+
+  for (p = first; p < last; p++) {
+    q = &particles[3 * p];
+    t = locate(dt, particles, q, start, &face);
+    if (t < 0)
+      goto done;
+    start = t;
+
+    dt->cur_stamp++;
+    queue.n = 0;
+    if (face < 0) {
+      dt->stamp[t] = dt->cur_stamp;
+      ivec_push(&queue, t);
+    } else {
+      hull_seen(dt, t, face);
+      ivec_push(&queue, HULL_NODE(t, face));
+    }
+
+    for (k = 0; k < queue.n; k++) {
+
+      if (queue.a[k] >= 0) { /* finite tet */
+
+        t = queue.a[k];
+        tet = &dt->tets[t];
+        if (!in_conflict(particles, tet, q)) {
+          if (k == 0) /* the tet containing q must be in conflict */
+            goto done;
+          continue;
+        }
+
+        if (!(dt->flags[t] & TET_CONFLICT)) {
+          if (!dt->flags[t])
+            ivec_push(touched, t);
+          dt->flags[t] |= TET_CONFLICT;
+          ivec_push(conflicts, t);
+        }
+
+        for (i = 0; i < 4; i++) {
+          n = tet->tets[i];
+          if (n < 0) {
+            if (!hull_seen(dt, t, i))
+              ivec_push(&queue, HULL_NODE(t, i));
+          } else if (dt->stamp[n] != dt->cur_stamp) {
+            dt->stamp[n] = dt->cur_stamp;
+            ivec_push(&queue, n);
+          }
+        }
+
+      } else { /* hull facet */
+
+        t = HULL_TET(queue.a[k]);
+        i = HULL_FACE(queue.a[k]);
+        tet = &dt->tets[t];
+        if (!hull_visible(particles, tet, i, q))
+          continue;
+
+        if (!dt->flags[t])
+          ivec_push(touched, t);
+        dt->flags[t] |= TET_VISIBLE(i);
+
+        if (dt->stamp[t] != dt->cur_stamp) {
+          dt->stamp[t] = dt->cur_stamp;
+          ivec_push(&queue, t);
+        }
+
+        /* adjacent hull facets across the three edges */
+        for (e = 0; e < 3; e++)
+          verts[e] = tet->verts[(i + 1 + e) % 4];
+        for (e = 0; e < 3; e++) {
+          n = hull_neighbor(dt, t, i, verts[e], verts[(e + 1) % 3], &nf);
+          if (n < 0)
+            goto done;
+          if (!hull_seen(dt, n, nf))
+            ivec_push(&queue, HULL_NODE(n, nf));
+        }
+
+      }
+
+    }
+  }
+  ret = 0;
+
+ done:
+  free(queue.a);
+  return ret;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  sorted vertex triple of the facet opposite vertex i of a tet
+*/
+static void face_key(const struct tet_t *tet, int i, int *key)
+{
+  int a, b, c, s;
+
+  a = tet->verts[(i + 1) % 4];
+  b = tet->verts[(i + 2) % 4];
+  c = tet->verts[(i + 3) % 4];
+  if (a > b) { s = a; a = b; b = s; }
+  if (b > c) { s = b; b = c; c = s; }
+  if (a > b) { s = a; a = b; b = s; }
+  key[0] = a;
+  key[1] = b;
+  key[2] = c;
+}
+
+static unsigned int face_hash(const int *key)
+{
+  return (unsigned int)key[0] * 73856093u ^ (unsigned int)key[1] * 19349663u ^
+    (unsigned int)key[2] * 83492791u;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  replaces the conflict tets with a triangulation of the cavity they leave
+  (extended by the region between the old hull and the new particles)
+
+  The new tets only use vertices of the conflict tets, of the visible hull
+  facets, and the new particles. Together with the kept tets bordering the
+  cavity (the ring), these vertices are triangulated by qhull. The ring tets
+  appear unchanged in this local triangulation, and the new tets are those
+  reached from the ring facets without crossing them.
+
+  changed: tets created or modified
+
+  returns 0 on success
+*/
+static int retriangulate(struct dblock_t *dblock, struct qhull_dt_t *dt,
+                         int first, int last,
+                         struct ivec_t *touched, struct ivec_t *conflicts,
+                         struct ivec_t *changed)
+{
+  const float *particles = dblock->particles;
+  struct dblock_t sub;                   /* local triangulation */
+  struct ivec_t verts = { NULL, 0, 0 };  /* vertices of the local triangulation */
+  struct ivec_t lost = { NULL, 0, 0 };   /* vertices whose tet is removed */
+  struct ivec_t queue = { NULL, 0, 0 };
+  struct reg_face_t *regs = NULL;        /* facets of the ring tets */
+  int num_regs = 0, max_regs = 0;
+  int *table = NULL;                     /* hash of ring facets */
+  unsigned int mask = 0, h;
+  int *reg_mark = NULL;                  /* ring facet + 1 per local tet facet */
+  int *new_idx = NULL;                   /* index of selected local tets */
+  char *is_kept = NULL;                  /* local tet is a ring tet */
+  char *in_sub = NULL;                   /* vertex appears in the local triangulation */
+  double *pts = NULL;
+  struct tet_t *tet;
+  int key[3], rkey[3];
+  int c, t, n, i, j, k, r, s, v, g;
+  int num_sel, num_holes, num_tets, base;
+  int ret = 1;
+
+  memset(&sub, 0, sizeof(sub));
+
+  /* collect the vertices and the ring facets */
+  dt->cur_stamp++;
+#define ADD_VERT(p) do {                                      \
+    if (dt->vert_stamp[(p)] != dt->cur_stamp) {               \
+      dt->vert_stamp[(p)] = dt->cur_stamp;                    \
+      ivec_push(&verts, (p));                                 \
+    } } while (0)
+#define ADD_REG(t_, f_, req_) do {                            \
+    if (num_regs == max_regs) {                               \
+      max_regs = max_regs ? 2 * max_regs : 64;                \
+      regs = (struct reg_face_t *)realloc(regs, max_regs * sizeof(struct reg_face_t)); \
+    }                                                         \
+    regs[num_regs].tet = (t_);                                \
+    regs[num_regs].face = (f_);                               \
+    regs[num_regs].required = (req_);                         \
+    regs[num_regs].k_sub = regs[num_regs].r_sub = -1;         \
+    num_regs++;                                               \
+  } while (0)
+
+  for (k = 0; k < conflicts->n; k++) {
+    c = conflicts->a[k];
+    for (i = 0; i < 4; i++)
+      ADD_VERT(dt->tets[c].verts[i]);
+    for (i = 0; i < 4; i++) {
+      n = dt->tets[c].tets[i];
+      if (n < 0 || (dt->flags[n] & TET_CONFLICT))
+        continue;
+      for (j = 0; j < 4; j++)
+        ADD_VERT(dt->tets[n].verts[j]);
+      for (j = 0; j < 4; j++)
+        if (dt->tets[n].tets[j] == c)
+          break;
+      if (j == 4)
+        goto done;
+      ADD_REG(n, j, 1);
+    }
+  }
+  for (k = 0; k < touched->n; k++) {
+    t = touched->a[k];
+    if (dt->flags[t] & TET_CONFLICT)
+      continue;
+    for (i = 0; i < 4; i++) {
+      if (!(dt->flags[t] & TET_VISIBLE(i)))
+        continue;
+      for (j = 0; j < 4; j++)
+        ADD_VERT(dt->tets[t].verts[j]);
+      ADD_REG(t, i, 0);
+    }
+  }
+  base = verts.n;
+  for (v = first; v < last; v++)
+    ivec_push(&verts, v);
+#undef ADD_VERT
+#undef ADD_REG
+
+  /* nothing is kept; a full recompute is just as good */
+  if (!num_regs || verts.n < 5)
+    goto done;
+
+  /* local triangulation, converted to particle indices */
+  pts = (double *)malloc(verts.n * 3 * sizeof(double));
+  for (k = 0; k < verts.n; k++)
+    for (j = 0; j < 3; j++)
+      pts[3 * k + j] = particles[3 * verts.a[k] + j];
+  if (run_qhull(verts.n, pts, &sub, 1) || !sub.num_tets)
+    goto done;
+
+  in_sub = (char *)calloc(verts.n, 1);
+  for (s = 0; s < sub.num_tets; s++)
+    for (j = 0; j < 4; j++) {
+      in_sub[sub.tets[s].verts[j]] = 1;
+      sub.tets[s].verts[j] = verts.a[sub.tets[s].verts[j]];
+    }
+
+  /* hash the ring facets */
+  for (k = 1; k < 2 * num_regs; k *= 2)
+    ;
+  mask = k - 1;
+  table = (int *)malloc(k * sizeof(int));
+  for (h = 0; h <= mask; h++)
+    table[h] = -1;
+  for (r = 0; r < num_regs; r++) {
+    face_key(&dt->tets[regs[r].tet], regs[r].face, key);
+    for (h = face_hash(key) & mask; table[h] >= 0; h = (h + 1) & mask)
+      ;
+    table[h] = r;
+  }
+
+  /* find the ring tets and the new tets across the ring facets */
+  reg_mark = (int *)calloc(4 * sub.num_tets, sizeof(int));
+  is_kept = (char *)calloc(sub.num_tets, 1);
+  for (s = 0; s < sub.num_tets; s++) {
+    for (j = 0; j < 4; j++) {
+      face_key(&sub.tets[s], j, key);
+      for (h = face_hash(key) & mask; (r = table[h]) >= 0; h = (h + 1) & mask) {
+        face_key(&dt->tets[regs[r].tet], regs[r].face, rkey);
+        if (key[0] == rkey[0] && key[1] == rkey[1] && key[2] == rkey[2])
+          break;
+      }
+      if (r < 0)
+        continue;
+
+      if (sub.tets[s].verts[j] == dt->tets[regs[r].tet].verts[regs[r].face]) {
+        if (regs[r].k_sub >= 0)
+          goto done;
+        regs[r].k_sub = s;
+        is_kept[s] = 1;
+      } else {
+        if (regs[r].r_sub >= 0)
+          goto done;
+        regs[r].r_sub = s;
+        regs[r].r_face = j;
+        reg_mark[4 * s + j] = r + 1;
+      }
+    }
+  }
+  for (r = 0; r < num_regs; r++) {
+    if (regs[r].k_sub < 0 || (regs[r].required && regs[r].r_sub < 0))
+      goto done;
+    if (regs[r].r_sub >= 0 &&
+        sub.tets[regs[r].r_sub].tets[regs[r].r_face] != regs[r].k_sub)
+      goto done;
+  }
+
+  /* flood the new tets from the ring facets */
+  new_idx = (int *)malloc(sub.num_tets * sizeof(int));
+  for (s = 0; s < sub.num_tets; s++)
+    new_idx[s] = -1;
+  num_sel = 0;
+  for (r = 0; r < num_regs; r++) {
+    s = regs[r].r_sub;
+    if (s >= 0 && new_idx[s] < 0) {
+      new_idx[s] = num_sel++;
+      ivec_push(&queue, s);
+    }
+  }
+  for (k = 0; k < queue.n; k++) {
+    s = queue.a[k];
+    if (is_kept[s])
+      goto done;
+    for (j = 0; j < 4; j++) {
+      n = sub.tets[s].tets[j];
+      if (reg_mark[4 * s + j] || n < 0 || new_idx[n] >= 0)
+        continue;
+      new_idx[n] = num_sel++;
+      ivec_push(&queue, n);
+    }
+  }
+
+  /* new tets refill the removed slots first, then are appended */
+  qsort(conflicts->a, conflicts->n, sizeof(int), cmp_int);
+  for (k = 0; k < queue.n; k++) {
+    s = queue.a[k];
+    new_idx[s] = new_idx[s] < conflicts->n ? conflicts->a[new_idx[s]] :
+      dt->num_tets + new_idx[s] - conflicts->n;
+  }
+  num_tets = dt->num_tets + (num_sel > conflicts->n ? num_sel - conflicts->n : 0);
+  reserve_state(dt, num_tets, last);
+
+  /* vertices whose tet is removed get a new one below */
+  for (k = 0; k < base; k++) {
+    v = verts.a[k];
+    t = dt->vert_to_tet[v];
+    if (t >= 0 && (dt->flags[t] & TET_CONFLICT)) {
+      dt->vert_to_tet[v] = -1;
+      ivec_push(&lost, v);
+    }
+  }
+  for (v = first; v < last; v++)
+    dt->vert_to_tet[v] = -1;
+
+  /* write the new tets and stitch them to the ring */
+  for (k = 0; k < queue.n; k++) {
+    s = queue.a[k];
+    g = new_idx[s];
+    ivec_push(changed, g);
+    tet = &dt->tets[g];
+    for (j = 0; j < 4; j++) {
+      tet->verts[j] = sub.tets[s].verts[j];
+      if ((r = reg_mark[4 * s + j])) {
+        tet->tets[j] = regs[r - 1].tet;
+        dt->tets[regs[r - 1].tet].tets[regs[r - 1].face] = g;
+      } else if ((n = sub.tets[s].tets[j]) >= 0)
+        tet->tets[j] = new_idx[n];
+      else
+        tet->tets[j] = -1;
+      if (dt->vert_to_tet[tet->verts[j]] < 0)
+        dt->vert_to_tet[tet->verts[j]] = g;
+    }
+  }
+  for (r = 0; r < num_regs; r++) {
+    ivec_push(changed, regs[r].tet);
+    for (j = 0; j < 4; j++) {
+      v = dt->tets[regs[r].tet].verts[j];
+      if (dt->vert_to_tet[v] < 0)
+        dt->vert_to_tet[v] = regs[r].tet;
+    }
+  }
+
+  /* sanity: no old vertex is lost, new particles are in the triangulation
+     unless qhull dropped them as duplicates */
+  for (k = 0; k < lost.n; k++)
+    if (dt->vert_to_tet[lost.a[k]] < 0)
+      goto done;
+  for (v = first; v < last; v++)
+    if (dt->vert_to_tet[v] < 0 && in_sub[base + v - first])
+      goto done;
+
+  /* compact the slots that were not refilled */
+  num_holes = conflicts->n > num_sel ? conflicts->n - num_sel : 0;
+  for (k = num_sel; k < conflicts->n; k++)
+    dt->flags[conflicts->a[k]] |= TET_HOLE;
+  num_tets -= num_holes;
+  t = dt->num_tets - 1;
+  for (k = num_sel; k < conflicts->n && conflicts->a[k] < num_tets; k++) {
+    c = conflicts->a[k];
+    while (dt->flags[t] & TET_HOLE)
+      t--;
+    dt->tets[c] = dt->tets[t];
+    dt->flags[t] |= TET_HOLE;
+    ivec_push(changed, c);
+    tet = &dt->tets[c];
+    for (j = 0; j < 4; j++) {
+      n = tet->tets[j];
+      if (n >= 0)
+        for (i = 0; i < 4; i++)
+          if (dt->tets[n].tets[i] == t)
+            dt->tets[n].tets[i] = c;
+      if (dt->vert_to_tet[tet->verts[j]] == t)
+        dt->vert_to_tet[tet->verts[j]] = c;
+    }
+    ivec_push(touched, t);   /* clears the flag afterwards */
+    t--;
+  }
+  dt->num_tets = num_tets;
+
+  /* moved tets were recorded at their new index */
+  for (k = j = 0; k < changed->n; k++)
+    if (changed->a[k] < num_tets)
+      changed->a[j++] = changed->a[k];
+  changed->n = j;
+  ret = 0;
+
+ done:
+  free(verts.a);
+  free(lost.a);
+  free(queue.a);
+  free(regs);
+  free(table);
+  free(reg_mark);
+  free(new_idx);
+  free(is_kept);
+  free(in_sub);
+  free(pts);
+  free(sub.tets);
+  return ret;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  inserts particles received since the previous round into the persistent
+  triangulation and records the created or modified tets in dblock
+
+  returns 0 on success, nonzero if the triangulation needs to be recomputed
+*/
+static int incremental_cells(struct dblock_t *dblock, struct qhull_dt_t *dt)
+{
+  struct ivec_t touched = { NULL, 0, 0 };   /* tets with flags set */
+  struct ivec_t conflicts = { NULL, 0, 0 }; /* tets to be replaced */
+  struct ivec_t changed = { NULL, 0, 0 };   /* tets created or modified */
+  int first = dt->num_particles;
+  int last = dblock->num_particles;
+  int k, ret;
+
+  if (!dt->num_tets || first > last || last - first > QH_MAX_INSERT * first)
+    return 1;
+  if (first == last) {
+    dblock->num_changed_tets = 0;
+    return 0;
+  }
+
+  reserve_state(dt, dt->num_tets, last);
+
+  ret = find_conflicts(dt, dblock->particles, first, last, &touched, &conflicts);
+  if (!ret)
+    ret = retriangulate(dblock, dt, first, last, &touched, &conflicts, &changed);
+
+  for (k = 0; k < touched.n; k++)
+    dt->flags[touched.a[k]] = 0;
+  free(touched.a);
+  free(conflicts.a);
+
+  if (!ret) {
+    dt->num_particles = last;
+    dblock->num_changed_tets = changed.n;
+    dblock->changed_tets = changed.a;
+  } else
+    free(changed.a);
+  return ret;
+}
+/*--------------------------------------------------------------------------*/
+/*
+  creates local delaunay cells
+
+  dblock: local block
+  num_threads: threads for the passes over the points and tets; qhull is not
+  reentrant, so the triangulation itself stays serial
+*/
+void local_cells(struct dblock_t *dblock, int num_threads)
+{
+  struct qhull_dt_t *dt = (struct qhull_dt_t *)dblock->Dt;
+  int j;
+
+  if (dt && !incremental_cells(dblock, dt)) {
+    dblock->num_tets = dt->num_tets;
+    reserve_tets(dblock, dt->num_tets);
+    memcpy(dblock->tets, dt->tets, dt->num_tets * sizeof(struct tet_t));
+    reserve_vert_to_tet(dblock, dblock->num_particles);
+    memcpy(dblock->vert_to_tet, dt->vert_to_tet, dblock->num_particles * sizeof(int));
+    return;
+  }
+
+  /* full recompute */
+
+  /* deep copy from float to double (qhull API is double) */
+  double *pts =
+    (double *)malloc(dblock->num_particles * 3 * sizeof(double));
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+  for (j = 0; j < 3 * dblock->num_particles; j++)
+    pts[j] = dblock->particles[j];
+
+  run_qhull(dblock->num_particles, pts, dblock, num_threads);
+
+  free(pts);
+
+  fill_vert_to_tet(dblock);
+  dblock->num_changed_tets = -1;
+
+  /* keep the triangulation for the next round */
+  if (dt) {
+    reserve_state(dt, dblock->num_tets, dblock->num_particles);
+    dt->num_tets = dblock->num_tets;
+    dt->num_particles = dblock->num_particles;
+    memcpy(dt->tets, dblock->tets, dblock->num_tets * sizeof(struct tet_t));
+    memcpy(dt->vert_to_tet, dblock->vert_to_tet, dblock->num_particles * sizeof(int));
+  }
 }
 /*--------------------------------------------------------------------------*/
 /*
@@ -96,7 +916,7 @@ void gen_delaunay_output(facetT *facetlist, struct dblock_t *dblock) {
   }
 
   dblock->num_tets = numfacets;
-  dblock->tets = (struct tet_t *)malloc(numfacets * sizeof(struct tet_t));
+  reserve_tets(dblock, numfacets);
 
   /* for all tets, get vertices */
   t = 0;
@@ -157,8 +977,9 @@ void gen_delaunay_output(facetT *facetlist, struct dblock_t *dblock) {
 /*--------------------------------------------------------------------------*/
 /*
 reorders neighbors in dblock such that ith neighbor is opposite ith vertex
+(each tet only modifies its own neighbors, so the tets are independent)
 */
-void reorder_neighbors(struct dblock_t *dblock) {
+void reorder_neighbors(struct dblock_t *dblock, int num_threads) {
 
   int t, v, n, nv; /*indices into tets, verts, neighbors, neighbor verts */
   int nbr; /* one neighbor tet */
@@ -166,6 +987,10 @@ void reorder_neighbors(struct dblock_t *dblock) {
   int tets[4];  /* newly ordered neighbors */
 
   /* tets */
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for private(v, n, nv, nbr, done, tets) num_threads(num_threads) \
+  schedule(static)
+#endif
   for (t = 0; t < dblock->num_tets; t++) {
 
     /* verts */
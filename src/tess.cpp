@@ -25,11 +25,14 @@
 #include <set>
 #include <algorithm>
 #include <cstring>
+#include <stdint.h>
 
 #include "tess/tess.h"
 #include "tess/tess.hpp"
 #include "tess/tet.hpp"
 #include "tess/tet-neighbors.h"
+#include "tess/volume.h"
+#include "tess/locate.h"
 
 #ifdef BGQ
 #include <spi/include/kernel/memory.h>
@@ -40,16 +43,82 @@
 
 using namespace std;
 
-size_t tess(diy::Master& master)
+//
+// termination detection for TESS_ROUNDS_COUNTING: a nonblocking all_reduce of the
+// cumulative sent and received message counts runs in the background of the next round and
+// is collected after it (so that all ranks decide in the same round)
+//
+// a round receives what the previous round sent, so once everything sent up to a round was
+// also received in it, that round sent nothing and every block is quiescent from then on
+//
+struct CountingWave
+{
+    CountingWave() : pending(false)                                 {}
+
+    unsigned long   local[2];           // sent, received on this rank when the wave started
+    unsigned long   global[2];          // sum over all ranks
+    MPI_Request     request;
+    bool            pending;
+};
+
+static bool counting_done(MPI_Comm                      comm,
+                          const std::vector<size_t>&    counts,
+                          CountingWave&                 wave)
+{
+    if (wave.pending)
+    {
+        MPI_Wait(&wave.request, MPI_STATUS_IGNORE);
+        wave.pending = false;
+
+        if (wave.global[0] == wave.global[1])
+            return true;
+    }
+
+    // start the next wave
+    wave.local[0] = wave.local[1] = 0;
+    for (size_t i = 0; i < counts.size(); i += 2)
+    {
+        wave.local[0] += counts[i];
+        wave.local[1] += counts[i + 1];
+    }
+    MPI_Iallreduce(wave.local, wave.global, 2, MPI_UNSIGNED_LONG, MPI_SUM, comm, &wave.request);
+    wave.pending = true;
+    return false;
+}
+
+//
+// predictive: ship a shell of particles, with the thickness estimated from the local
+// particle density, to all neighbors in the first round; this usually saves several
+// rounds, while the usual check of incomplete cells still guarantees correctness
+//
+// mode: TESS_ROUNDS_SYNC runs the rounds in lockstep; TESS_ROUNDS_ASYNC lets every block
+// retriangulate as soon as it receives particles, without a barrier between rounds
+// (requires building with TESS_ASYNC, and all blocks in memory); returns the largest
+// number of times a local block was processed in this mode; TESS_ROUNDS_COUNTING keeps the
+// rounds but replaces the per-round all_reduce with counting termination detection, and
+// lets blocks without new particles or neighbors sit out the rounds
+//
+// num_threads: threads used inside each block for its local triangulation, for runs with
+// few large blocks per process (in addition to any diy threads working on separate blocks)
+//
+size_t tess(diy::Master& master,
+            bool predictive,
+            tess_rounds mode,
+            int num_threads,
+            bool reorder)
 {
     double times[TESS_MAX_TIMES]; // timing
     quants_t quants; // quantity stats
-    return tess(master, quants, times);
+    return tess(master, quants, times, predictive, mode, num_threads, reorder);
 }
 
 size_t tess(diy::Master& master,
             quants_t& quants,
-            double* times)
+            double* times,
+            bool predictive,
+            tess_rounds mode,
+            int num_threads,
+            bool reorder)
 {
 #ifdef TIMING
     // if (master.threads() != 1)
@@ -74,13 +143,61 @@ size_t tess(diy::Master& master,
     int done      = false;
     size_t rounds = 0;
 
+#ifndef TESS_ASYNC
+    if (mode == TESS_ROUNDS_ASYNC)
+    {
+        if (master.communicator().rank() == 0)
+            fprintf(stderr, "Warning: tess was built without TESS_ASYNC; "
+                    "using synchronous rounds\n");
+        mode = TESS_ROUNDS_SYNC;
+    }
+#else
+    if (mode == TESS_ROUNDS_ASYNC)
+    {
+        double start = MPI_Wtime();
+        std::vector<AsyncState> states(master.size());
+        master.iexchange([&](DBlock* b, const diy::Master::ProxyWithLink& cp) -> bool
+                         {
+                             int lid = cp.master()->lid(cp.gid());
+                             return delaunay_async(b, cp, original_links, states[lid], predictive,
+                                                   num_threads);
+                         });
+        unsigned long invocations = 0;
+        for (size_t i = 0; i < states.size(); ++i)
+            invocations = std::max(invocations, (unsigned long)states[i].invocations);
+        unsigned long max_invocations;
+        MPI_Allreduce(&invocations, &max_invocations, 1, MPI_UNSIGNED_LONG, MPI_MAX,
+                      master.communicator());
+        rounds = max_invocations;
+
+        if (master.communicator().rank() == 0)
+            fprintf(stderr, "[%d]: Time for asynchronous rounds = %f s\n",
+                    master.communicator().rank(), MPI_Wtime() - start);
+        done = true;
+    }
+#endif
+
+    std::vector<size_t> counts;                        // sent, received messages per block
+    CountingWave        wave;
+    if (mode == TESS_ROUNDS_COUNTING)
+        counts.resize(2 * master.size(), 0);
+
     while (!done)
     {
         rounds++;
 
         double start = MPI_Wtime();
-        master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
-                       { delaunay(b, cp, original_links, last_neighbors, first); });
+        if (mode == TESS_ROUNDS_COUNTING)
+            master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                           {
+                               int lid = cp.master()->lid(cp.gid());
+                               delaunay(b, cp, original_links, last_neighbors, first, predictive,
+                                        &counts[2 * lid], num_threads);
+                           });
+        else
+            master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+                           { delaunay(b, cp, original_links, last_neighbors, first, predictive,
+                                      NULL, num_threads); });
         master.exchange();
 
         if (master.communicator().rank() == 0)
@@ -88,7 +205,10 @@ size_t tess(diy::Master& master,
                     master.communicator().rank(), rounds, MPI_Wtime() - start);
 
         first = false;
-        done = master.proxy(master.loaded_block()).read<int>();
+        if (mode == TESS_ROUNDS_COUNTING)
+            done = counting_done(master.communicator(), counts, wave);
+        else
+            done = master.proxy(master.loaded_block()).read<int>();
 
 #ifdef MEMORY
         get_mem(rounds, master.communicator());
@@ -97,16 +217,43 @@ size_t tess(diy::Master& master,
 
     // this is not ideal, but need to do this to collect statistics and mark
     // blocks as complete; TODO: this of how to get rid of this
-    quants.sum_quants[NUM_ORIG_PTS] = 0;
-    quants.sum_quants[NUM_FINAL_PTS] = 0;
-    quants.sum_quants[NUM_TETS] = 0;
-    quants.sum_quants[NUM_LOC_BLOCKS] = master.size();
+    // (each block fills its own quantities, merged afterwards in the order of the blocks,
+    // so that diy threads can finalize the blocks)
+    std::vector<quants_t> block_quants(master.size());
     master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
-                   { finalize(b, cp, quants); });
+                   { finalize(b, cp, block_quants[cp.master()->lid(cp.gid())], reorder); });
 
-    // restore the original links
+    for (int k = 0; k < MAX_QUANTS; k++)
+    {
+        quants.min_quants[k] = 0;
+        quants.max_quants[k] = 0;
+        quants.sum_quants[k] = 0;
+    }
+    for (size_t i = 0; i < block_quants.size(); ++i)
+        for (int k = NUM_ORIG_PTS; k <= NUM_TETS; k++)
+        {
+            if (i == 0 || block_quants[i].min_quants[k] < quants.min_quants[k])
+                quants.min_quants[k] = block_quants[i].min_quants[k];
+            if (i == 0 || block_quants[i].max_quants[k] > quants.max_quants[k])
+                quants.max_quants[k] = block_quants[i].max_quants[k];
+            quants.sum_quants[k] += block_quants[i].sum_quants[k];
+        }
+    quants.min_quants[NUM_LOC_BLOCKS] = master.size();
+    quants.max_quants[NUM_LOC_BLOCKS] = master.size();
+    quants.sum_quants[NUM_LOC_BLOCKS] = master.size();
+
+    // keep the neighbors of the last round, then restore the original links
     for (size_t i = 0; i < master.size(); ++i)
+    {
+        DBlock* b = master.block<DBlock>(i);
+        diy::Link* l = master.link(i);
+        std::set<int> gids;
+        b->round_neighbors.clear();
+        for (int j = 0; j < l->size(); ++j)
+            if (l->target(j).gid != b->gid && gids.insert(l->target(j).gid).second)
+                b->round_neighbors.push_back(l->target(j));
         master.replace_link(i, new RCLink(original_links[i]));
+    }
 
     timing(times, -1, DEL_TIME, master.communicator());
 
@@ -128,6 +275,11 @@ void tess_save(diy::Master& master,
 {
     // write output
     timing(times, OUT_TIME, -1, master.communicator());
+    master.foreach([](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        if (!b->adj_offsets)
+            fill_adjacency(b);
+    });
     if (outfile[0])
         diy::io::write_blocks(outfile, master.communicator(), master, extra, &save_block_light);
 
@@ -156,6 +308,21 @@ void* create_block()
 {
     DBlock* b = new DBlock;
     b->complete = 0;
+    b->num_changed_tets = -1;
+    b->changed_tets = NULL;
+    b->max_particles = 0;
+    b->max_tets = 0;
+    b->max_vert_to_tet = 0;
+    b->complete_cells = NULL;
+    b->orig_ids = NULL;
+    b->adj_offsets = NULL;
+    b->adj_gids = NULL;
+    b->adj_lids = NULL;
+    b->density = NULL;
+    b->num_grid_pts = 0;
+    b->density_tiles = NULL;
+    b->num_density_tiles = 0;
+    b->spheres_current = false;
     init_delaunay_data_structure(b);
     return b;
 }
@@ -170,10 +337,12 @@ void destroy_block(void* b_)
     if (b->rem_gids)      free(b->rem_gids);
     if (b->rem_lids)      free(b->rem_lids);
     if (b->vert_to_tet)   free(b->vert_to_tet);
+    if (b->changed_tets)  free(b->changed_tets);
+    if (b->complete_cells) free(b->complete_cells);
+    if (b->orig_ids)      free(b->orig_ids);
+    free_adjacency(b);
 
-    // density
-    if (b->density)
-        delete[] b->density;   // allocated with new, freed with delete
+    free_density(b);
 
     if (b->Dt)
         clean_delaunay_data_structure(b);
@@ -207,13 +376,25 @@ void save_block_light(const void* b_,
     diy::save(bb, d.particles, 3 * d.num_particles);
     diy::save(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
     diy::save(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
-    diy::save(bb, d.num_grid_pts);
-    diy::save(bb, d.density, d.num_grid_pts);
+    save_density(bb, d);
 
     diy::save(bb, d.complete);
     diy::save(bb, d.num_tets);
     diy::save(bb, d.tets, d.num_tets);
     diy::save(bb, d.vert_to_tet, d.num_particles);
+    diy::save(bb, d.complete_cells, (d.num_particles + 7) / 8);
+
+    int num_ids = d.orig_ids ? d.num_orig_particles : 0;
+    diy::save(bb, num_ids);
+    diy::save(bb, d.orig_ids, num_ids);
+
+    int num_offsets = d.adj_offsets ? d.num_orig_particles + 1 : 0;
+    int num_adj     = d.adj_offsets ? d.adj_offsets[d.num_orig_particles] : 0;
+    diy::save(bb, num_offsets);
+    diy::save(bb, num_adj);
+    diy::save(bb, d.adj_offsets, num_offsets);
+    diy::save(bb, d.adj_gids, num_adj);
+    diy::save(bb, d.adj_lids, num_adj);
 }
 
 void load_block_light(void* b_,
@@ -242,9 +423,7 @@ void load_block_light(void* b_,
     }
     diy::load(bb, d.rem_gids, d.num_particles - d.num_orig_particles);
     diy::load(bb, d.rem_lids, d.num_particles - d.num_orig_particles);
-    diy::load(bb, d.num_grid_pts);
-    d.density = new float[d.num_grid_pts];
-    diy::load(bb, d.density, d.num_grid_pts);
+    load_density(bb, d);
 
     diy::load(bb, d.complete);
     diy::load(bb, d.num_tets);
@@ -254,6 +433,35 @@ void load_block_light(void* b_,
     if (d.num_particles)
         d.vert_to_tet = (int*)malloc(d.num_particles * sizeof(int));
     diy::load(bb, d.vert_to_tet, d.num_particles);
+    d.complete_cells = (unsigned char*)malloc((d.num_particles + 7) / 8);
+    diy::load(bb, d.complete_cells, (d.num_particles + 7) / 8);
+
+    int num_ids;
+    diy::load(bb, num_ids);
+    d.orig_ids = NULL;
+    if (num_ids)
+        d.orig_ids = (int*)malloc(num_ids * sizeof(int));
+    diy::load(bb, d.orig_ids, num_ids);
+
+    int num_offsets, num_adj;
+    diy::load(bb, num_offsets);
+    diy::load(bb, num_adj);
+    d.adj_offsets = NULL;
+    d.adj_gids = NULL;
+    d.adj_lids = NULL;
+    if (num_offsets)
+    {
+        d.adj_offsets = (int*)malloc(num_offsets * sizeof(int));
+        d.adj_gids = (int*)malloc(num_adj * sizeof(int));
+        d.adj_lids = (int*)malloc(num_adj * sizeof(int));
+    }
+    diy::load(bb, d.adj_offsets, num_offsets);
+    diy::load(bb, d.adj_gids, num_adj);
+    diy::load(bb, d.adj_lids, num_adj);
+
+    d.max_particles = d.num_particles;
+    d.max_tets = d.num_tets;
+    d.max_vert_to_tet = d.num_particles;
 }
 
 //
@@ -346,23 +554,80 @@ int gen_particles(DBlock* b,
     return n;
 }
 
+//
+// adds the neighbors in in_link, the original link of link neighbor ii, to link
+//
+static void add_neighbors(RCLink*                                               link,
+                          size_t                                                ii,
+                          const RCLink&                                         in_link,
+                          int                                                   gid,
+                          std::set< std::pair<diy::BlockID, diy::Direction> >&  neighbor_blocks)
+{
+    for (size_t j = 0; j < in_link.size(); ++j)
+    {
+        if (in_link.target(j).gid == gid) continue;        // skip self
+
+        // add wrap of the neighbor we got the link from to the link's wrap
+        diy::Direction wrap = link->wrap(ii);
+        //fprintf(stderr, "[%d] -> %d: wrap = (%d,%d,%d); -> %d = (%d,%d,%d)\n",
+        //                gid, link->target(ii).gid,
+        //                wrap[0], wrap[1], wrap[2],
+        //                in_link.target(j).gid,
+        //                in_link.wrap(j)[0], in_link.wrap(j)[1], in_link.wrap(j)[2]);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            wrap[k] += in_link.wrap(j)[k];
+            if (wrap[k] < -1 || wrap[k] > 1)
+            {
+                fprintf(stderr, "Warning: something is odd with the wrap, "
+                        "it exceeds a single wrap-around\n");
+            }
+        }
+        //fprintf(stderr, "   -> wrap = (%d,%d,%d)\n",
+        //                wrap[0], wrap[1], wrap[2]);
+
+        bool inserted = neighbor_blocks.insert(std::make_pair(in_link.target(j),wrap)).second;
+        if (!inserted) continue;
+
+        link->add_neighbor(in_link.target(j));
+        link->add_direction(in_link.direction(j));
+        link->add_bounds(in_link.bounds(j));
+        link->add_wrap(wrap);
+    }
+}
+
+//
+// one round of the tessellation
+//
+// counts: when given, the block adds the messages (links and particles) it sends and
+// receives to counts[0] and counts[1] instead of taking part in the all_reduce, and a block
+// that received nothing new this round stays quiescent, keeping its cells from the last round
+//
 void delaunay(DBlock*                           b,
               const diy::Master::ProxyWithLink& cp,
               const LinkVector&                 links,
               LastNeighbors&                    neighbors,
-              bool                              first)
+              bool                              first,
+              bool                              predictive,
+              size_t*                           counts,
+              int                               num_threads)
 {
     int               lid           = cp.master()->lid(cp.gid());
     const RCLink&     original_link = links[lid];
     size_t&           last_neighbor = neighbors[lid];
     RCLink*           link          = dynamic_cast<RCLink*>(cp.link());
 
-    // cleanup block
-    reset_block(b);
-
     // clear collectives
     cp.collectives()->clear();
 
+    // the particle arrays may have been reallocated since the last tess(), e.g., by the
+    // redistribution of the particles, so only count on what is in use
+    if (first)
+        b->max_particles = b->num_particles;
+
+    size_t received = 0;
+    bool   changed  = first;
     LinkVector in_links;
     if (!first)       // we don't receive on the first round
     {
@@ -379,7 +644,10 @@ void delaunay(DBlock*                           b,
         last_neighbor = link->size();       // update last_neighbor
 
         // parse received particles
+        int num_particles = b->num_particles;
         neighbor_particles(b, cp);
+        received = in_links.size() + (b->num_particles - num_particles);
+        changed  = b->num_particles > num_particles;
 
         // update the links, taking care of duplicates
 
@@ -392,48 +660,30 @@ void delaunay(DBlock*                           b,
         //     (in fact, even duplicate pruning is based on BlockID)
         //     So this wouldn't work with wrap on (past a single round).
         for (size_t i = 0; i < in_links.size(); ++i)
+            add_neighbors(link, i + last_last_neighbor, in_links[i], cp.gid(), neighbor_blocks);
         {
-            size_t ii = i + last_last_neighbor;
-            for (size_t j = 0; j < in_links[i].size(); ++j)
-            {
-                if (in_links[i].target(j).gid == cp.gid()) continue;        // skip self
-
-                // add wrap of the neighbor we got the link from to the link's wrap
-                diy::Direction wrap = link->wrap(ii);
-                //fprintf(stderr, "[%d] -> %d: wrap = (%d,%d,%d); -> %d = (%d,%d,%d)\n",
-                //                cp.gid(), link->target(ii).gid,
-                //                wrap[0], wrap[1], wrap[2],
-                //                in_links[i].target(j).gid,
-                //                in_links[i].wrap(j)[0], in_links[i].wrap(j)[1], in_links[i].wrap(j)[2]);
-
-                for (int k = 0; k < 3; ++k)
-                {
-                    wrap[k] += in_links[i].wrap(j)[k];
-                    if (wrap[k] < -1 || wrap[k] > 1)
-                    {
-                        fprintf(stderr, "Warning: something is odd with the wrap, "
-                                "it exceeds a single wrap-around\n");
-                    }
-                }
-                //fprintf(stderr, "   -> wrap = (%d,%d,%d)\n",
-                //                wrap[0], wrap[1], wrap[2]);
-
-                bool inserted = neighbor_blocks.insert(std::make_pair(in_links[i].target(j),wrap)).second;
-                if (!inserted) continue;
-
-                link->add_neighbor(in_links[i].target(j));
-                link->add_direction(in_links[i].direction(j));
-                link->add_bounds(in_links[i].bounds(j));
-                link->add_wrap(wrap);
-            }
+            // master is shared by the diy threads processing the blocks
+            static diy::fast_mutex expected_mutex;
+            diy::lock_guard<diy::fast_mutex> lock(expected_mutex);
+            cp.master()->add_expected(link->size_unique() - original_size_unique);
         }
-        cp.master()->add_expected(link->size_unique() - original_size_unique);
+        changed = changed || last_neighbor < link->size();
     }
     //fprintf(stderr, "Links updated; last_neighbor = %lu\n", last_neighbor);
 
+    if (counts)
+    {
+        counts[1] += received;
+        if (!changed)       // quiescent: nothing to recompute or send
+            return;
+    }
+
+    // cleanup block (the particles stay)
+    reset_block(b);
+
     // compute (or update) the local tessellation
     if (b->num_orig_particles)
-        local_cells(b);
+        local_cells(b, num_threads);
     else
         fill_vert_to_tet(b);
 
@@ -446,69 +696,457 @@ void delaunay(DBlock*                           b,
 
     // enqueue points to neighbors
     int done = 1;
+    size_t num = 0;
     if (b->num_orig_particles)
     {
-        size_t num = incomplete_cells(b, cp, last_neighbor);
+        num = incomplete_cells(b, cp, last_neighbor, first && predictive);
         done = (num == 0);
     }
-    cp.all_reduce(done, std::logical_and<int>());
+
+    if (counts)
+        counts[0] += (link->size() - last_neighbor) + num;
+    else
+        cp.all_reduce(done, std::logical_and<int>());
 }
 
+//
+// marks the block complete, optionally reorders its particles and tets (see
+// reorder_particles()), fills its bitmap of complete cells and its circumspheres, and
+// fills quants with the quantities of this block only
+//
 void finalize(DBlock*                         b,
               const diy::Master::ProxyWithLink& cp,
-              quants_t&                         quants)
+              quants_t&                         quants,
+              bool                              reorder)
 {
-    static bool first = true;
     b->complete = 1;
+    if (reorder)
+        reorder_particles(b);
+    fill_complete_cells(b);
+    update_spheres(b);
 
     // collect quantities
-    if (first || b->num_orig_particles < quants.min_quants[NUM_ORIG_PTS])
-        quants.min_quants[NUM_ORIG_PTS] = b->num_orig_particles;
-    if (first || b->num_orig_particles > quants.max_quants[NUM_ORIG_PTS])
-        quants.max_quants[NUM_ORIG_PTS] = b->num_orig_particles;
-    quants.sum_quants[NUM_ORIG_PTS] += b->num_orig_particles;
-
-    if (first || b->num_particles < quants.min_quants[NUM_FINAL_PTS])
-        quants.min_quants[NUM_FINAL_PTS] = b->num_particles;
-    if (first || b->num_particles > quants.max_quants[NUM_FINAL_PTS])
-        quants.max_quants[NUM_FINAL_PTS] = b->num_particles;
-    quants.sum_quants[NUM_FINAL_PTS] += b->num_particles;
-
-    if (first || b->num_tets < quants.min_quants[NUM_TETS])
-        quants.min_quants[NUM_TETS] = b->num_tets;
-    if (first || b->num_tets > quants.max_quants[NUM_TETS])
-        quants.max_quants[NUM_TETS] = b->num_tets;
-    quants.sum_quants[NUM_TETS] += b->num_tets;
-
-    first = false;
+    quants.min_quants[NUM_ORIG_PTS]  = b->num_orig_particles;
+    quants.max_quants[NUM_ORIG_PTS]  = b->num_orig_particles;
+    quants.sum_quants[NUM_ORIG_PTS]  = b->num_orig_particles;
+
+    quants.min_quants[NUM_FINAL_PTS] = b->num_particles;
+    quants.max_quants[NUM_FINAL_PTS] = b->num_particles;
+    quants.sum_quants[NUM_FINAL_PTS] = b->num_particles;
+
+    quants.min_quants[NUM_TETS]      = b->num_tets;
+    quants.max_quants[NUM_TETS]      = b->num_tets;
+    quants.sum_quants[NUM_TETS]      = b->num_tets;
 
     // debug
     //   fprintf(stderr, "phase 3 gid %d num_tets %d num_particles %d \n",
     //           b->gid, b->num_tets, b->num_particles);
 }
 
+//
+// recomputes the cached circumsphere of a tet and whether it is settled, i.e.,
+// has no local particles, or has no convex hull facet and a circumsphere too
+// deep inside the block to stick out; a settled tet stays settled as long as
+// it exists, since adding particles never turns an interior facet into a
+// convex hull facet
+//
+static void settle_tet(DBlock* dblock,
+                       const RCLink* l,
+                       int t)
+{
+    tet_t& tet = dblock->tets[t];
+    dblock->settled[t] &= ~TET_SETTLED;
+
+    int j;
+    for (j = 0; j < 4; ++j)
+        if (tet.verts[j] < dblock->num_orig_particles)
+            break;
+    if (j == 4)	    // no local particles in the tet, so we don't care
+    {
+        dblock->settled[t] |= TET_SETTLED;
+        return;
+    }
+
+    // cached cirumcenter of tet and radius from circumcenter to any vertex
+    float center[3] = { dblock->spheres.x[t], dblock->spheres.y[t], dblock->spheres.z[t] };
+    float rad = dblock->spheres.r[t];
+
+    for (j = 0; j < 4; ++j)
+        if (tet.tets[j] == -1)
+            return;
+    for (j = 0; j < 3; ++j)
+    {
+        if (center[j] - l->bounds().min[j] <= rad) return;
+        if (l->bounds().max[j] - center[j] <= rad) return;
+    }
+    dblock->settled[t] |= TET_SETTLED;
+}
+
+//
+// brings the settled tets and cached circumspheres up to date with the tets
+// changed by local_cells() and returns the tets that are not settled
+//
+static const std::vector<int>& unsettled_tets(DBlock* dblock,
+                                              const RCLink* l)
+{
+    bool all = dblock->num_changed_tets < 0 ||
+               dblock->settled.empty() != (dblock->num_tets == 0);
+
+    update_spheres(dblock);
+    dblock->settled.resize(dblock->num_tets, 0);
+
+    if (all)
+    {
+        dblock->unsettled.clear();
+        for (int t = 0; t < dblock->num_tets; ++t)
+        {
+            dblock->settled[t] = 0;
+            settle_tet(dblock, l, t);
+            if (!(dblock->settled[t] & TET_SETTLED))
+            {
+                dblock->settled[t] |= TET_LISTED;
+                dblock->unsettled.push_back(t);
+            }
+        }
+        return dblock->unsettled;
+    }
+
+    for (int i = 0; i < dblock->num_changed_tets; ++i)
+    {
+        int t = dblock->changed_tets[i];
+        settle_tet(dblock, l, t);
+        if (!(dblock->settled[t] & (TET_SETTLED | TET_LISTED)))
+        {
+            dblock->settled[t] |= TET_LISTED;
+            dblock->unsettled.push_back(t);
+        }
+    }
+
+    // drop the tets that have settled or no longer exist
+    size_t n = 0;
+    for (size_t i = 0; i < dblock->unsettled.size(); ++i)
+    {
+        int t = dblock->unsettled[i];
+        if (t >= dblock->num_tets)
+            continue;
+        if (dblock->settled[t] & TET_SETTLED)
+        {
+            dblock->settled[t] &= ~TET_LISTED;
+            continue;
+        }
+        dblock->unsettled[n++] = t;
+    }
+    dblock->unsettled.resize(n);
+
+    return dblock->unsettled;
+}
+
+//
+// packed ghost particle batches
+//
+// Particles sent to one neighbor are packed into a batch. The sender gid is
+// implicit (it is the gid of the incoming queue). Each coordinate is mapped to
+// its order-preserving integer key and stored as an offset from the smallest
+// key in the batch, using as many bits as the key range needs. This quantizes
+// the coordinates to the batch bounds and round-trips them exactly; a batch
+// spanning a wide range of magnitudes simply falls back to 32 bits (the raw
+// float). Local ids are sorted, so they are stored as bit-packed deltas.
+//
+// batch layout:
+//   int           number of particles
+//   int           first lid
+//   unsigned char bits per lid delta
+//   unsigned int  minimum key in x, y, z
+//   unsigned char bits per key offset in x, y, z
+//   bit stream    (lid delta, x, y, z offsets) per particle, padded to a byte
+//
+
+// order-preserving map between floats and unsigned ints
+static inline unsigned int float_key(float f)
+{
+    unsigned int u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+static inline float key_float(unsigned int k)
+{
+    unsigned int u = (k & 0x80000000u) ? (k & 0x7fffffffu) : ~k;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// number of bits needed to represent v
+static inline unsigned char num_bits(unsigned int v)
+{
+    unsigned char n = 0;
+    while (v)
+    {
+        ++n;
+        v >>= 1;
+    }
+    return n;
+}
+
+//
+// packs particles p (in increasing order) going to link neighbor i and enqueues them;
+// tagged prefixes the batch with TESS_MSG_PARTICLES for the asynchronous rounds
+//
+static void enqueue_particles(DBlock*                           dblock,
+                              const diy::Master::ProxyWithLink& cp,
+                              const RCLink*                     l,
+                              int                               i,
+                              const std::vector<int>&           p,
+                              bool                              tagged)
+{
+    int n = p.size();
+
+    // wrapped coordinates and their keys
+    std::vector<unsigned int> keys(3 * n);
+    unsigned int  key_min[3], key_max[3];
+    for (int j = 0; j < n; ++j)
+    {
+        point_t rp;
+        rp.x = dblock->particles[3 * p[j]];
+        rp.y = dblock->particles[3 * p[j] + 1];
+        rp.z = dblock->particles[3 * p[j] + 2];
+        wrap_pt(rp, l->wrap(i), dblock->data_bounds);
+
+        keys[3 * j]     = float_key(rp.x);
+        keys[3 * j + 1] = float_key(rp.y);
+        keys[3 * j + 2] = float_key(rp.z);
+        for (int k = 0; k < 3; ++k)
+        {
+            if (j == 0 || keys[3 * j + k] < key_min[k]) key_min[k] = keys[3 * j + k];
+            if (j == 0 || keys[3 * j + k] > key_max[k]) key_max[k] = keys[3 * j + k];
+        }
+    }
+
+    unsigned int max_delta = 0;
+    for (int j = 1; j < n; ++j)
+        max_delta = std::max(max_delta, (unsigned int)(p[j] - p[j - 1]));
+
+    unsigned char lid_bits = num_bits(max_delta);
+    unsigned char key_bits[3];
+    for (int k = 0; k < 3; ++k)
+        key_bits[k] = num_bits(key_max[k] - key_min[k]);
+
+    // bit stream
+    size_t bits = (size_t)n * (lid_bits + key_bits[0] + key_bits[1] + key_bits[2]);
+    std::vector<unsigned char> stream((bits + 7) / 8);
+    size_t     pos   = 0;
+    uint64_t   acc   = 0;
+    int        nacc  = 0;
+    for (int j = 0; j < n; ++j)
+    {
+        for (int k = -1; k < 3; ++k)
+        {
+            unsigned int  v  = k < 0 ? (j ? p[j] - p[j - 1] : 0) : keys[3 * j + k] - key_min[k];
+            unsigned char nb = k < 0 ? lid_bits : key_bits[k];
+            acc  |= (uint64_t)v << nacc;
+            nacc += nb;
+            while (nacc >= 8)
+            {
+                stream[pos++] = acc & 0xff;
+                acc  >>= 8;
+                nacc  -= 8;
+            }
+        }
+    }
+    if (nacc)
+        stream[pos++] = acc & 0xff;
+
+    diy::MemoryBuffer& out = cp.outgoing(l->target(i));
+    if (tagged)
+        diy::save(out, (int)TESS_MSG_PARTICLES);
+    diy::save(out, n);
+    diy::save(out, p[0]);
+    diy::save(out, lid_bits);
+    diy::save(out, key_min, 3);
+    diy::save(out, key_bits, 3);
+    if (!stream.empty())
+        diy::save(out, &stream[0], stream.size());
+}
+
+//
+// decodes the next packed batch from in straight into the particles of the block,
+// with gid as the owner of the particles
+//
+static void dequeue_particles(diy::MemoryBuffer&   in,
+                              DBlock*              b,
+                              int                  gid)
+{
+    int           n, lid;
+    unsigned char lid_bits;
+    unsigned int  key_min[3];
+    unsigned char key_bits[3];
+    diy::load(in, n);
+    diy::load(in, lid);
+    diy::load(in, lid_bits);
+    diy::load(in, key_min, 3);
+    diy::load(in, key_bits, 3);
+
+    // the bit stream is read in place
+    size_t bits = (size_t)n * (lid_bits + key_bits[0] + key_bits[1] + key_bits[2]);
+    const unsigned char* stream = (const unsigned char*)&in.buffer[0] + in.position;
+    in.position += (bits + 7) / 8;
+
+    reserve_particles(b, b->num_particles + n);
+    float* pt  = b->particles + 3 * b->num_particles;
+    int    r   = b->num_particles - b->num_orig_particles;
+
+    size_t     pos   = 0;
+    uint64_t   acc   = 0;
+    int        nacc  = 0;
+    for (int j = 0; j < n; ++j)
+    {
+        for (int k = -1; k < 3; ++k)
+        {
+            unsigned char nb = k < 0 ? lid_bits : key_bits[k];
+            while (nacc < nb)
+            {
+                acc  |= (uint64_t)stream[pos++] << nacc;
+                nacc += 8;
+            }
+            unsigned int v = acc & ((nb == 32) ? 0xffffffffu : ((1u << nb) - 1));
+            acc  >>= nb;
+            nacc  -= nb;
+
+            if (k < 0)
+                lid += v;
+            else
+                *pt++ = key_float(key_min[k] + v);
+        }
+        b->rem_gids[r + j] = gid;
+        b->rem_lids[r + j] = lid;
+    }
+    b->num_particles += n;
+}
+
+//
+// predicted ghost shell
+//
+// Particles within a slab along each face of the block are counted in a grid
+// of tiles over the face. The tile density gives the radius of a ball that
+// would hold TESS_SHELL_KNN particles, which is taken as the thickness of the
+// shell of particles that neighbors past that face need.
+//
+#define TESS_SHELL_TILES 8         // tiles along each edge of a face
+#define TESS_SHELL_KNN   32        // particles in the ball of the predicted radius
+
+static void predict_shell(DBlock*                         dblock,
+                          const RCLink*                   l,
+                          size_t                          last_neighbor,
+                          std::vector< std::set<int> >&   to_send)
+{
+    const int                    T  = TESS_SHELL_TILES;
+    const diy::ContinuousBounds& bb = dblock->bounds;
+
+    float ext[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        ext[d] = bb.max[d] - bb.min[d];
+        if (ext[d] <= 0.0f)
+            return;
+    }
+    float max_rad = 0.5f * std::min(ext[0], std::min(ext[1], ext[2]));
+
+    // tile of face 2 * d + side under particle x
+    auto tile = [&](const float* x, int d, int side)
+    {
+        int a  = (d + 1) % 3, b = (d + 2) % 3;
+        int ia = std::max(0, std::min(T - 1, (int)((x[a] - bb.min[a]) / ext[a] * T)));
+        int ib = std::max(0, std::min(T - 1, (int)((x[b] - bb.min[b]) / ext[b] * T)));
+        return ((2 * d + side) * T + ia) * T + ib;
+    };
+
+    // count the particles in the slab of depth ext / T along each face
+    std::vector<int> counts(6 * T * T, 0);
+    for (int p = 0; p < dblock->num_orig_particles; ++p)
+    {
+        const float* x = &dblock->particles[3 * p];
+        for (int d = 0; d < 3; ++d)
+        {
+            if (x[d] - bb.min[d] < ext[d] / T) counts[tile(x, d, 0)]++;
+            if (bb.max[d] - x[d] < ext[d] / T) counts[tile(x, d, 1)]++;
+        }
+    }
+
+    // radius of a ball holding TESS_SHELL_KNN particles at the tile density
+    std::vector<float> radius(6 * T * T);
+    float shell = 0.0f;
+    for (int d = 0; d < 3; ++d)
+    {
+        float vol = ext[0] * ext[1] * ext[2] / (T * T * T);
+        for (int t = 2 * d * T * T; t < (2 * d + 2) * T * T; ++t)
+        {
+            radius[t] = max_rad;
+            if (counts[t])
+                radius[t] = std::min(max_rad,
+                                     (float)cbrt(3.0 * TESS_SHELL_KNN * vol /
+                                                 (4.0 * M_PI * counts[t])));
+            shell = std::max(shell, radius[t]);
+        }
+    }
+
+    // faces of the block past which each new neighbor lies
+    std::vector< std::vector<int> > faces(l->size());
+    std::vector<diy::ContinuousBounds> neigh_bounds(l->size());
+    for (int i = last_neighbor; i < l->size(); ++i)
+    {
+        neigh_bounds[i] = l->bounds(i);
+        diy::wrap_bounds(neigh_bounds[i], l->wrap(i), dblock->data_bounds, l->dimension());
+        for (int d = 0; d < 3; ++d)
+        {
+            if (neigh_bounds[i].max[d] <= bb.min[d]) faces[i].push_back(2 * d);
+            if (neigh_bounds[i].min[d] >= bb.max[d]) faces[i].push_back(2 * d + 1);
+        }
+    }
+
+    for (int p = 0; p < dblock->num_orig_particles; ++p)
+    {
+        float* x = &dblock->particles[3 * p];
+
+        // skip particles deeper than any predicted radius
+        int d;
+        for (d = 0; d < 3; ++d)
+            if (x[d] - bb.min[d] <= shell || bb.max[d] - x[d] <= shell)
+                break;
+        if (d == 3)
+            continue;
+
+        for (int i = last_neighbor; i < l->size(); ++i)
+        {
+            float rad = 0.0f;
+            for (size_t f = 0; f < faces[i].size(); ++f)
+                rad = std::max(rad, radius[tile(x, faces[i][f] / 2, faces[i][f] % 2)]);
+            if (rad > 0.0f && diy::distance(3, neigh_bounds[i], x) <= rad)
+                to_send[p].insert(i);
+        }
+    }
+}
+
 size_t incomplete_cells(struct DBlock *dblock,
                         const diy::Master::ProxyWithLink& cp,
-                        size_t last_neighbor)
+                        size_t last_neighbor,
+                        bool predict,
+                        bool tagged)
 {
     RCLink* l = dynamic_cast<RCLink*>(cp.link());
     std::vector< std::set<int> > to_send(dblock->num_orig_particles);
 
-    // for all tets
-    for (int t = 0; t < dblock->num_tets; t++)
+    // only the tets that are not settled can send particles
+    const std::vector<int>& unsettled = unsettled_tets(dblock, l);
+
+    for (size_t u = 0; u < unsettled.size(); u++)
     {
+        int t = unsettled[u];
         int j;
-        for (j = 0; j < 4; ++j)
-            if (dblock->tets[t].verts[j] < dblock->num_orig_particles)
-                break;
-        if (j == 4)	    // no local particles in the tet, so we don't care
-            continue;
 
-        // cirumcenter of tet and radius from circumcenter to any vertex
-        float center[3]; // circumcenter
-        circumcenter(center, &dblock->tets[t], dblock->particles);
-        int p = dblock->tets[t].verts[0];
-        float rad = distance(center, &dblock->particles[3 * p]);
+        // cached cirumcenter of tet and radius from circumcenter to any vertex
+        float center[3] = { dblock->spheres.x[t], dblock->spheres.y[t], dblock->spheres.z[t] };
+        float rad = dblock->spheres.r[t];
 
         // check for a convex hull facet
         for (j = 0; j < 4; ++j)
@@ -597,30 +1235,29 @@ size_t incomplete_cells(struct DBlock *dblock,
         }
     }
 
-    // enqueue the particles
-    size_t enqueued = 0;
-    //size_t convex_hull = 0;
-    point_t rp; // particle being sent
+    // predictive first round: also ship the estimated ghost shell
+    if (predict)
+        predict_shell(dblock, l, last_neighbor, to_send);
+
+    // group the particles by destination
+    std::vector< std::vector<int> > dests(l->size());
     for (int p = 0; p < dblock->num_orig_particles; p++)
     {
         for (set<int>::iterator it  = to_send[p].begin();
              it != to_send[p].end();
              it++)
-        {
-            rp.x   = dblock->particles[3 * p];
-            rp.y   = dblock->particles[3 * p + 1];
-            rp.z   = dblock->particles[3 * p + 2];
-            rp.gid = dblock->gid;
-            rp.lid = p;
-            wrap_pt(rp, l->wrap(*it), dblock->data_bounds);
-            cp.enqueue(l->target(*it), rp);
-            ++enqueued;
+            dests[*it].push_back(p);
+    }
 
-            //if (!complete(p, dblock->tets, dblock->num_tets, dblock->vert_to_tet[p]))
-            //  ++convex_hull;
-        }
+    // enqueue the particles, one packed batch per destination
+    size_t enqueued = 0;
+    for (int i = last_neighbor; i < l->size(); ++i)
+    {
+        if (dests[i].empty())
+            continue;
+        enqueue_particles(dblock, cp, l, i, dests[i], tagged);
+        enqueued += dests[i].size();
     }
-    //fprintf(stderr, "[%d]: %lu convex hull particles; %lu total\n", cp.gid(), convex_hull, enqueued);
 
     return enqueued;
 }
@@ -631,66 +1268,715 @@ size_t incomplete_cells(struct DBlock *dblock,
 void neighbor_particles(DBlock* b,
                         const diy::Master::ProxyWithLink& cp)
 {
-    diy::Link* l = cp.link();
     std::vector<int> in; // gids of sources
     cp.incoming(in);
 
-    // count total number of incoming points
-    int numpts = 0;
+    // decode the packed batches; the gid of the source is the owner
     for (int i = 0; i < (int)in.size(); i++)
     {
         diy::MemoryBuffer& in_queue = cp.incoming(in[i]);
-        numpts += (in_queue.size() - in_queue.position) / sizeof(point_t);
+        while (in_queue.position < in_queue.size())
+            dequeue_particles(in_queue, b, in[i]);
     }
+}
+
+#ifdef TESS_ASYNC
+
+//
+// one step of the asynchronous rounds, called by iexchange whenever the block has incoming
+// messages; the messages are tagged records: the original link of a sender (TESS_MSG_LINK)
+// or a packed batch of its particles (TESS_MSG_PARTICLES)
+//
+// links from blocks that are not yet our neighbors are kept pending until the block that
+// introduces them tells us about them, so that the wrap of the new neighbor is known
+//
+// returns true when the block has nothing more to send
+//
+bool delaunay_async(DBlock*                           b,
+                    const diy::Master::ProxyWithLink& cp,
+                    const LinkVector&                 links,
+                    AsyncState&                       state,
+                    bool                              predictive,
+                    int                               num_threads)
+{
+    int               lid           = cp.master()->lid(cp.gid());
+    const RCLink&     original_link = links[lid];
+    RCLink*           link          = dynamic_cast<RCLink*>(cp.link());
+
+    state.invocations++;
+    if (!state.started)
+        b->max_particles = b->num_particles;
+
+    // read all the records that arrived so far
+    std::vector<int> in;
+    cp.incoming(in);
 
-    // grow space for remote particles
-    int n = (b->num_particles - b->num_orig_particles);
-    if (numpts)
+    int num_particles = b->num_particles;
+    for (size_t i = 0; i < in.size(); ++i)
     {
-        b->particles =
-            (float *)realloc(b->particles, (b->num_particles + numpts) * 3 * sizeof(float));
-        b->rem_gids  = (int*)realloc(b->rem_gids, (n + numpts) * sizeof(int));
-        b->rem_lids  = (int*)realloc(b->rem_lids, (n + numpts) * sizeof(int));
+        diy::MemoryBuffer& in_queue = cp.incoming(in[i]);
+        while (in_queue.position < in_queue.size())
+        {
+            int tag;
+            diy::load(in_queue, tag);
+            if (tag == TESS_MSG_LINK)
+            {
+                RCLink* l = dynamic_cast<RCLink*>(diy::LinkFactory::load(in_queue));
+                state.pending.push_back(std::make_pair(in[i], *l));
+                delete l;
+            }
+            else
+                dequeue_particles(in_queue, b, in[i]);
+        }
     }
 
-    // copy received particles
-    for (int i = 0; i < (int)in.size(); i++)
+    if (state.started && b->num_particles == num_particles && state.pending.empty())
+        return true;
+
+    // cleanup block
+    reset_block(b);
+
+    // update the links with the pending links whose senders are our neighbors; adding
+    // neighbors can make other pending links usable, so repeat until nothing changes
+    std::set< std::pair<diy::BlockID, diy::Direction> > neighbor_blocks;
+    for (size_t i = 0; i < link->size(); ++i)
+        neighbor_blocks.insert(std::make_pair(link->target(i), link->wrap(i)));
+
+    bool progress = true;
+    while (progress)
     {
-        diy::MemoryBuffer& in_queue = cp.incoming(in[i]);
-        numpts = (in_queue.size() - in_queue.position) / sizeof(point_t);
-        vector<point_t> pts;
-        pts.resize(numpts);
-        diy::load(in_queue, &pts[0], numpts);
+        progress = false;
+        for (size_t p = 0; p < state.pending.size(); )
+        {
+            size_t ii = 0;
+            while (ii < link->size() && link->target(ii).gid != state.pending[p].first)
+                ++ii;
+            if (ii == link->size())
+            {
+                ++p;
+                continue;
+            }
+            size_t size = link->size();
+            add_neighbors(link, ii, state.pending[p].second, cp.gid(), neighbor_blocks);
+            progress = progress || link->size() > size;
+            state.pending.erase(state.pending.begin() + p);
+        }
+    }
+
+    // compute (or update) the local tessellation
+    if (b->num_orig_particles)
+        local_cells(b, num_threads);
+    else
+        fill_vert_to_tet(b);
+
+    // enqueue the original link to the new neighbors
+    size_t first_new = state.last_sent;
+    for (size_t i = first_new; i < link->size(); ++i)
+    {
+        diy::MemoryBuffer& out = cp.outgoing(link->target(i));
+        diy::save(out, (int)TESS_MSG_LINK);
+        diy::LinkFactory::save(out, &original_link);
+    }
+    state.last_sent = link->size();
 
-        for (int j = 0; j < numpts; j++)
+    // enqueue points to neighbors
+    size_t num = 0;
+    if (b->num_orig_particles)
+        num = incomplete_cells(b, cp, first_new, !state.started && predictive, true);
+
+    state.started = true;
+    return num == 0 && first_new == link->size();
+}
+
+#endif
+
+//
+// fills the Delaunay edges of a block as pairs (u,v), u < v, so that every edge appears once
+// across all the blocks: an edge between two ghosts is left to the blocks that own them, an
+// edge between an original particle and a ghost to the block with the smaller gid (both
+// blocks have the edge once the cells of its endpoints are complete)
+//
+// a ghost of the block itself (periodic, rem_gid == gid) is the image of an original
+// particle, and the edge also appears from the other end, between that particle and the
+// image of u; it is kept when the ghost's rem_lid is greater than the input order id of u,
+// or, for an edge between a particle and its own image, when the image lies after u in
+// (x,y,z) order
+//
+void fill_edges(std::vector<int>& edges,
+                DBlock*           dblock,
+                int               num_threads)
+{
+    fill_edges(edges, dblock->tets, dblock->num_tets, num_threads);
+
+    // the original particles come first, so u is original if either end is
+    int    n_orig = dblock->num_orig_particles;
+    size_t n      = 0;
+    for (size_t i = 0; i < edges.size(); i += 2)
+    {
+        int u = edges[i], v = edges[i + 1];
+        if (u >= n_orig)
+            continue;
+        if (v >= n_orig && dblock->rem_gids[v - n_orig] < dblock->gid)
+            continue;
+        if (v >= n_orig && dblock->rem_gids[v - n_orig] == dblock->gid)
         {
-            b->particles[3 * b->num_particles    ] = pts[j].x;
-            b->particles[3 * b->num_particles + 1] = pts[j].y;
-            b->particles[3 * b->num_particles + 2] = pts[j].z;
-            b->rem_gids[n] = pts[j].gid;
-            b->rem_lids[n] = pts[j].lid;
+            int    id_u = dblock->orig_ids ? dblock->orig_ids[u] : u;
+            int    id_v = dblock->rem_lids[v - n_orig];
+            float* pu   = &dblock->particles[3 * u];
+            float* pv   = &dblock->particles[3 * v];
+            if (id_v < id_u ||
+                (id_v == id_u && !std::lexicographical_compare(pu, pu + 3, pv, pv + 3)))
+                continue;
+        }
+        edges[n++] = u;
+        edges[n++] = v;
+    }
+    edges.resize(n);
+}
+
+//
+// locates a batch of query positions in a block: the containing tet (-1 outside the convex
+// hull) and the nearest site (a particle, original or ghost) of each
+//
+void locate(DBlock*      dblock,
+            const float* queries,
+            int          num_queries,
+            int*         tets,
+            int*         sites,
+            int          num_threads)
+{
+    if (dblock->stars.offsets.empty())
+        fill_vert_stars(dblock->stars, dblock->tets, dblock->num_tets, dblock->num_particles);
+
+    locate_grid_t grid;
+    fill_locate_grid(grid, dblock->particles, dblock->num_particles, dblock->vert_to_tet);
+
+    locate(tets, sites, queries, num_queries, dblock->tets, dblock->num_tets, dblock->vert_to_tet,
+           dblock->stars, dblock->particles, grid, num_threads);
+}
+
+// a query routed to the block that contains it, and the answer routed back
+struct locate_query_t
+{
+    float       x[3];
+    int         id;                                  // index of the query in the asking block
+};
+struct locate_answer_t
+{
+    int         id;
+    locate_t    result;
+};
 
-            b->num_particles++;
-            n++;
+//
+// answers queries x located in this block
+//
+static void answer_queries(DBlock*         dblock,
+                           const float*    x,
+                           int             n,
+                           locate_t*       results,
+                           int             num_threads)
+{
+    std::vector<int> tets(n), sites(n);
+    if (n)
+        locate(dblock, x, n, &tets[0], &sites[0], num_threads);
+
+    int n_orig = dblock->num_orig_particles;
+    for (int i = 0; i < n; ++i)
+    {
+        locate_t& r = results[i];
+        int s = sites[i];
+        r.gid = dblock->gid;
+        r.tet = tets[i];
+        if (s == -1)
+        {
+            r.site_gid = -1;
+            r.site_lid = -1;
+        }
+        else if (s < n_orig)
+        {
+            r.site_gid = dblock->gid;
+            r.site_lid = dblock->orig_ids ? dblock->orig_ids[s] : s;
+        }
+        else
+        {
+            r.site_gid = dblock->rem_gids[s - n_orig];
+            r.site_lid = dblock->rem_lids[s - n_orig];
         }
     }
 }
+
+//
+// locates the query positions of every block (queries[lid] = x1,y1,z1,x2,y2,z2,...) in the
+// block whose bounds contain them; a query outside the block's bounds goes to the link
+// neighbor that contains it, shifted by the neighbor's wrap if the domain is periodic,
+// and one that no neighbor contains gets gid -1
+//
+void locate(diy::Master&                           master,
+            const std::vector< std::vector<float> >& queries,
+            std::vector< std::vector<locate_t> >&  results,
+            int                                    num_threads)
+{
+    const locate_t none = { -1, -1, -1, -1 };
+    results.resize(master.size());
+
+    // the queries each block answers itself, by lid, kept until the neighbors' arrive so
+    // that the block locates all of its queries in one batch
+    std::vector< std::vector<int> > local_ids(master.size());
+
+    // send the queries outside the blocks to their blocks
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int     lid = cp.master()->lid(cp.gid());
+        RCLink* l   = dynamic_cast<RCLink*>(cp.link());
+        const std::vector<float>& q = queries[lid];
+        int     n   = q.size() / 3;
+        results[lid].assign(n, none);
+
+        std::vector< std::vector<locate_query_t> > out(l->size());
+        for (int i = 0; i < n; ++i)
+        {
+            const float* x = &q[3 * i];
+            int j;
+            for (j = 0; j < 3; ++j)
+                if (x[j] < b->bounds.min[j] || x[j] > b->bounds.max[j])
+                    break;
+            if (j == 3)
+            {
+                local_ids[lid].push_back(i);
+                continue;
+            }
+
+            std::set<int> dests;
+            in(*l, x, std::inserter(dests, dests.end()), b->data_bounds);
+            if (dests.empty())
+                continue;
+
+            // a query sent across a periodic boundary moves into the neighbor's coordinates
+            int     k  = *dests.begin();
+            point_t rp = { x[0], x[1], x[2] };
+            wrap_pt(rp, l->wrap(k), b->data_bounds);
+            locate_query_t query = { { rp.x, rp.y, rp.z }, i };
+            out[k].push_back(query);
+        }
+
+        for (int i = 0; i < l->size(); ++i)
+            if (!out[i].empty())
+                cp.enqueue(l->target(i), &out[i][0], out[i].size());
+    });
+    master.exchange();
+
+    // answer the local queries and those of the neighbors together, so that the search
+    // structures of the block (see locate(DBlock*, ...)) are built once
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int              lid = cp.master()->lid(cp.gid());
+        RCLink*          l   = dynamic_cast<RCLink*>(cp.link());
+        const std::vector<int>& mine = local_ids[lid];
+        std::vector<int> in;
+        cp.incoming(in);
+
+        std::vector<float> x;
+        for (size_t i = 0; i < mine.size(); ++i)
+            x.insert(x.end(), &queries[lid][3 * mine[i]], &queries[lid][3 * mine[i]] + 3);
+
+        std::vector< std::vector<locate_query_t> > asked(in.size());
+        for (size_t i = 0; i < in.size(); ++i)
+        {
+            int m = cp.incoming(in[i]).buffer.size() / sizeof(locate_query_t);
+            if (!m)
+                continue;
+            asked[i].resize(m);
+            cp.dequeue(in[i], &asked[i][0], m);
+            for (int k = 0; k < m; ++k)
+                x.insert(x.end(), asked[i][k].x, asked[i][k].x + 3);
+        }
+
+        int n = x.size() / 3;
+        std::vector<locate_t> answers(n);
+        if (n)
+            answer_queries(b, &x[0], n, &answers[0], num_threads);
+
+        for (size_t i = 0; i < mine.size(); ++i)
+            results[lid][mine[i]] = answers[i];
+
+        size_t next = mine.size();
+        for (size_t i = 0; i < in.size(); ++i)
+        {
+            int m = asked[i].size();
+            if (!m)
+                continue;
+            std::vector<locate_answer_t> back(m);
+            for (int k = 0; k < m; ++k)
+            {
+                back[k].id     = asked[i][k].id;
+                back[k].result = answers[next++];
+            }
+            for (int k = 0; k < l->size(); ++k)
+                if (l->target(k).gid == in[i])
+                {
+                    cp.enqueue(l->target(k), &back[0], m);
+                    break;
+                }
+        }
+    });
+    master.exchange();
+
+    // collect the answers
+    master.foreach([&](DBlock* b, const diy::Master::ProxyWithLink& cp)
+    {
+        int              lid = cp.master()->lid(cp.gid());
+        std::vector<int> in;
+        cp.incoming(in);
+
+        for (size_t i = 0; i < in.size(); ++i)
+        {
+            int n = cp.incoming(in[i]).buffer.size() / sizeof(locate_answer_t);
+            if (!n)
+                continue;
+            std::vector<locate_answer_t> back(n);
+            cp.dequeue(in[i], &back[0], n);
+            for (int k = 0; k < n; ++k)
+                results[lid][back[k].id] = back[k].result;
+        }
+    });
+}
+
+//
+// fills the Voronoi adjacency graph of the original particles in CSR form (adj_offsets,
+// adj_gids, adj_lids) from one pass over the tets; the neighbors of a particle are the other
+// ends of its Delaunay edges, so an incomplete cell lists only the neighbors found so far
+//
+// the neighbor lids are input order ids, as the rem_lids of the ghosts are, also after
+// reorder_particles()
+//
+void fill_adjacency(DBlock* dblock,
+                    int     num_threads)
+{
+    int n_orig = dblock->num_orig_particles;
+
+    std::vector<int> edges;
+    if (dblock->num_tets)
+        fill_edges(edges, dblock->tets, dblock->num_tets, num_threads);
+
+    int* offsets = (int*)realloc(dblock->adj_offsets, (n_orig + 1) * sizeof(int));
+    memset(offsets, 0, (n_orig + 1) * sizeof(int));
+    for (size_t i = 0; i < edges.size(); ++i)
+        if (edges[i] < n_orig)
+            offsets[edges[i] + 1]++;
+    for (int v = 0; v < n_orig; ++v)
+        offsets[v + 1] += offsets[v];
+
+    int num_adj = offsets[n_orig];
+    int* gids = (int*)realloc(dblock->adj_gids, std::max(num_adj, 1) * sizeof(int));
+    int* lids = (int*)realloc(dblock->adj_lids, std::max(num_adj, 1) * sizeof(int));
+
+    std::vector<int> next(offsets, offsets + n_orig);
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        int v = edges[i];
+        int u = edges[i ^ 1];                        // other end of the edge
+        if (v >= n_orig)
+            continue;
+        int k = next[v]++;
+        if (u < n_orig)
+        {
+            gids[k] = dblock->gid;
+            lids[k] = dblock->orig_ids ? dblock->orig_ids[u] : u;
+        }
+        else
+        {
+            gids[k] = dblock->rem_gids[u - n_orig];
+            lids[k] = dblock->rem_lids[u - n_orig];
+        }
+    }
+
+    dblock->adj_offsets = offsets;
+    dblock->adj_gids = gids;
+    dblock->adj_lids = lids;
+}
+
+//
+// saves the density field, dense or tiled
+//
+void save_density(diy::BinaryBuffer& bb,
+                  const dblock_t&    dblock)
+{
+    diy::save(bb, dblock.num_grid_pts);
+    diy::save(bb, dblock.num_density_tiles);
+    if (!dblock.density_tiles)
+    {
+        diy::save(bb, dblock.density, dblock.num_grid_pts);
+        return;
+    }
+    for (int i = 0; i < dblock.num_density_tiles; i++)
+    {
+        int n = dblock.density_tiles[i] ? DENSE_TILE_PTS : 0; // tiles without density are skipped
+        diy::save(bb, n);
+        diy::save(bb, dblock.density_tiles[i], n);
+    }
+}
+
+//
+// loads the density field saved by save_density()
+//
+void load_density(diy::BinaryBuffer& bb,
+                  dblock_t&          dblock)
+{
+    diy::load(bb, dblock.num_grid_pts);
+    diy::load(bb, dblock.num_density_tiles);
+    dblock.density = NULL;
+    dblock.density_tiles = NULL;
+    if (!dblock.num_density_tiles)
+    {
+        dblock.density = new float[dblock.num_grid_pts];
+        diy::load(bb, dblock.density, dblock.num_grid_pts);
+        return;
+    }
+    dblock.density_tiles = (float**)calloc(dblock.num_density_tiles, sizeof(float*));
+    for (int i = 0; i < dblock.num_density_tiles; i++)
+    {
+        int n;
+        diy::load(bb, n);
+        if (n)
+            dblock.density_tiles[i] = (float*)malloc(n * sizeof(float));
+        diy::load(bb, dblock.density_tiles[i], n);
+    }
+}
+
+//
+// frees the density field
+//
+void free_density(dblock_t* dblock)
+{
+    delete[] dblock->density;   // allocated with new, freed with delete
+    if (dblock->density_tiles)
+    {
+        for (int i = 0; i < dblock->num_density_tiles; i++)
+            free(dblock->density_tiles[i]);
+        free(dblock->density_tiles);
+    }
+    dblock->density = NULL;
+    dblock->num_grid_pts = 0;
+    dblock->density_tiles = NULL;
+    dblock->num_density_tiles = 0;
+}
+
+//
+// frees the adjacency graph, which is stale once the tets or the particle order change
+//
+void free_adjacency(dblock_t* dblock)
+{
+    free(dblock->adj_offsets);
+    free(dblock->adj_gids);
+    free(dblock->adj_lids);
+    dblock->adj_offsets = NULL;
+    dblock->adj_gids = NULL;
+    dblock->adj_lids = NULL;
+}
+
+//
+// spreads the low 21 bits of x to every third bit
+//
+static uint64_t spread_bits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x <<  8) & 0x100f00f00f00f00fULL;
+    x = (x | x <<  4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x <<  2) & 0x1249249249249249ULL;
+    return x;
+}
+
+//
+// sorts the original particles, and separately the ghost particles, along a Morton curve,
+// and the tets by their smallest vertex in the new order, so that the traversals of the
+// tets touch nearby memory
+//
+// keeps rem_gids, rem_lids and vert_to_tet consistent and records the input order of the
+// original particles in orig_ids; the caches indexed by particle or tet and the native
+// triangulation are reset
+//
+void reorder_particles(DBlock* dblock)
+{
+    int n      = dblock->num_particles;
+    int n_orig = dblock->num_orig_particles;
+    int n_tets = dblock->num_tets;
+    float* particles = dblock->particles;
+    if (!n)
+        return;
+
+    // Morton keys in the bounding box of the particles
+    float min[3], max[3], scale[3];
+    for (int j = 0; j < 3; ++j)
+        min[j] = max[j] = particles[j];
+    for (int p = 1; p < n; ++p)
+        for (int j = 0; j < 3; ++j)
+        {
+            min[j] = std::min(min[j], particles[3 * p + j]);
+            max[j] = std::max(max[j], particles[3 * p + j]);
+        }
+    for (int j = 0; j < 3; ++j)
+        scale[j] = max[j] > min[j] ? 0x1fffff / (max[j] - min[j]) : 0;
+
+    std::vector<uint64_t> keys(n);
+    for (int p = 0; p < n; ++p)
+    {
+        keys[p] = 0;
+        for (int j = 0; j < 3; ++j)
+        {
+            // the float product can round up past the last cell at max[j]
+            uint64_t q = (uint64_t)((particles[3 * p + j] - min[j]) * scale[j]);
+            keys[p] |= spread_bits(std::min(q, (uint64_t)0x1fffff)) << j;
+        }
+    }
+
+    // new to old (order) and old to new (rank) particle indices
+    std::vector<int> order(n), rank(n);
+    for (int p = 0; p < n; ++p)
+        order[p] = p;
+    std::stable_sort(order.begin(), order.begin() + n_orig,
+                     [&keys](int a, int b) { return keys[a] < keys[b]; });
+    std::stable_sort(order.begin() + n_orig, order.end(),
+                     [&keys](int a, int b) { return keys[a] < keys[b]; });
+    for (int p = 0; p < n; ++p)
+        rank[order[p]] = p;
+
+    // particles, ghost owners, input order
+    std::vector<float> old_particles(particles, particles + 3 * n);
+    for (int p = 0; p < n; ++p)
+        for (int j = 0; j < 3; ++j)
+            particles[3 * p + j] = old_particles[3 * order[p] + j];
+
+    std::vector<int> old_gids(dblock->rem_gids, dblock->rem_gids + n - n_orig);
+    std::vector<int> old_lids(dblock->rem_lids, dblock->rem_lids + n - n_orig);
+    for (int p = n_orig; p < n; ++p)
+    {
+        dblock->rem_gids[p - n_orig] = old_gids[order[p] - n_orig];
+        dblock->rem_lids[p - n_orig] = old_lids[order[p] - n_orig];
+    }
+
+    int* ids = (int*)malloc(n_orig * sizeof(int));
+    for (int p = 0; p < n_orig; ++p)
+        ids[p] = dblock->orig_ids ? dblock->orig_ids[order[p]] : order[p];
+    free(dblock->orig_ids);
+    dblock->orig_ids = ids;
+
+    // tets by their smallest vertex (a counting sort, ties keep their order)
+    std::vector<int> tet_rank(n_tets), first(n + 1, 0);
+    for (int t = 0; t < n_tets; ++t)
+    {
+        int m = n;
+        for (int i = 0; i < 4; ++i)
+            m = std::min(m, rank[dblock->tets[t].verts[i]]);
+        tet_rank[t] = m;
+        first[m + 1]++;
+    }
+    for (int p = 0; p < n; ++p)
+        first[p + 1] += first[p];
+    for (int t = 0; t < n_tets; ++t)
+        tet_rank[t] = first[tet_rank[t]]++;
+
+    std::vector<tet_t> old_tets(dblock->tets, dblock->tets + n_tets);
+    for (int t = 0; t < n_tets; ++t)
+    {
+        tet_t& tet = dblock->tets[tet_rank[t]];
+        for (int i = 0; i < 4; ++i)
+        {
+            tet.verts[i] = rank[old_tets[t].verts[i]];
+            tet.tets[i]  = old_tets[t].tets[i] == -1 ? -1 : tet_rank[old_tets[t].tets[i]];
+        }
+    }
+
+    std::vector<int> old_vert_to_tet(dblock->vert_to_tet, dblock->vert_to_tet + n);
+    for (int p = 0; p < n; ++p)
+        dblock->vert_to_tet[rank[p]] = old_vert_to_tet[p] == -1 ? -1 : tet_rank[old_vert_to_tet[p]];
+
+    // everything indexed by the old particles or tets
+    if (dblock->changed_tets)
+        free(dblock->changed_tets);
+    dblock->changed_tets = NULL;
+    dblock->num_changed_tets = -1;
+    dblock->settled.clear();
+    dblock->unsettled.clear();
+    dblock->stars.offsets.clear();
+    dblock->stars.tets.clear();
+    dblock->mirrors.clear();
+    dblock->spheres_current = false;
+    free_adjacency(dblock);
+    clean_delaunay_data_structure(dblock);
+    init_delaunay_data_structure(dblock);
+}
+
 //
 // cleans a block in between phases
-// (deletes tets but keeps delauany data structure and convex hull particles, sent particles)
+// (deletes tets but keeps delauany data structure and convex hull particles, sent particles;
+// the tets and vert_to_tet arrays stay allocated for the next round)
 //
 void reset_block(struct DBlock* &dblock)
 {
     // free old data
-    if (dblock->tets)
-        free(dblock->tets);
-    if (dblock->vert_to_tet)
-        free(dblock->vert_to_tet);
+    if (dblock->changed_tets)
+        free(dblock->changed_tets);
 
     // initialize new data
     dblock->num_tets = 0;
-    dblock->tets = NULL;
-    dblock->vert_to_tet = NULL;
+    dblock->num_changed_tets = -1;
+    dblock->changed_tets = NULL;
+    dblock->stars.offsets.clear();
+    dblock->stars.tets.clear();
+    dblock->mirrors.clear();
+    dblock->spheres_current = false;
+    free_adjacency(dblock);
+}
+//
+// new capacity for at least n items, at least doubling the old one
+//
+static int grow_capacity(int cap, int n)
+{
+    return std::max(n, 2 * cap);
+}
+//
+// makes room for n particles, keeping the existing ones; rem_gids and rem_lids get room
+// for the n - num_orig_particles ghosts
+//
+void reserve_particles(dblock_t* dblock, int n)
+{
+    if (n <= dblock->max_particles)
+        return;
+
+    int cap = grow_capacity(dblock->max_particles, n);
+    int rem = cap - dblock->num_orig_particles;
+    dblock->particles = (float*)realloc(dblock->particles, cap * 3 * sizeof(float));
+    dblock->rem_gids  = (int*)realloc(dblock->rem_gids, rem * sizeof(int));
+    dblock->rem_lids  = (int*)realloc(dblock->rem_lids, rem * sizeof(int));
+    dblock->max_particles = cap;
+}
+//
+// makes room for n tets, without keeping the existing ones
+//
+void reserve_tets(dblock_t* dblock, int n)
+{
+    if (n <= dblock->max_tets)
+        return;
+
+    int cap = grow_capacity(dblock->max_tets, n);
+    free(dblock->tets);
+    dblock->tets = (tet_t*)malloc(cap * sizeof(tet_t));
+    dblock->max_tets = cap;
+}
+//
+// makes room for n entries of vert_to_tet, without keeping the existing ones
+//
+void reserve_vert_to_tet(dblock_t* dblock, int n)
+{
+    if (n <= dblock->max_vert_to_tet)
+        return;
+
+    int cap = grow_capacity(dblock->max_vert_to_tet, n);
+    free(dblock->vert_to_tet);
+    dblock->vert_to_tet = (int*)malloc(cap * sizeof(int));
+    dblock->max_vert_to_tet = cap;
 }
 //
 // wraps point coordinates
@@ -766,8 +2052,7 @@ void fill_vert_to_tet(dblock_t* dblock)
 {
     //fprintf(stderr, "fill_vert_to_tet(): %d %d\n", dblock->num_particles, dblock->num_tets);
 
-    dblock->vert_to_tet =
-        (int*)realloc(dblock->vert_to_tet, sizeof(int) * dblock->num_particles);
+    reserve_vert_to_tet(dblock, dblock->num_particles);
 
     for (int p = 0; p < dblock->num_particles; ++p)
         dblock->vert_to_tet[p] = -1;
@@ -784,6 +2069,101 @@ void fill_vert_to_tet(dblock_t* dblock)
     }
 }
 //
+// marks the particles whose Voronoi cells are complete, in one pass over the tets:
+// a cell is incomplete if its particle is in no tet or on a convex hull face
+//
+void fill_complete_cells(dblock_t* dblock)
+{
+    int nbytes = (dblock->num_particles + 7) / 8;
+    dblock->complete_cells = (unsigned char*)realloc(dblock->complete_cells, nbytes);
+    memset(dblock->complete_cells, 0, nbytes);
+
+    for (int p = 0; p < dblock->num_particles; ++p)
+        if (dblock->vert_to_tet[p] != -1)
+            dblock->complete_cells[p >> 3] |= 1 << (p & 7);
+
+    for (int t = 0; t < dblock->num_tets; ++t)
+        for (int i = 0; i < 4; ++i)
+        {
+            if (dblock->tets[t].tets[i] != -1)
+                continue;
+            for (int v = 0; v < 4; ++v)
+            {
+                int p = dblock->tets[t].verts[v];
+                if (v != i)
+                    dblock->complete_cells[p >> 3] &= ~(1 << (p & 7));
+            }
+        }
+}
+//
+// brings the cached circumspheres up to date with the tets: recomputes only the tets
+// changed by local_cells() when it reports them, all the tets otherwise
+//
+void update_spheres(DBlock* dblock)
+{
+    if (dblock->spheres_current)
+        return;
+
+    if (dblock->num_changed_tets < 0 || (dblock->spheres.r.empty() && dblock->num_tets))
+        fill_circumspheres(dblock->spheres, dblock->tets, dblock->num_tets, dblock->particles);
+    else
+        update_circumspheres(dblock->spheres, dblock->tets, dblock->num_tets,
+                             dblock->changed_tets, dblock->num_changed_tets, dblock->particles);
+    dblock->spheres_current = true;
+}
+//
+// fills the Voronoi mesh of the complete cells of the original particles of a block
+// (builds the stars and brings the circumspheres up to date first)
+//
+// first_site, last_site: only the particles in [first_site, last_site), so that a large block
+// can be processed a range of cells at a time; last_site -1 means all the original particles
+//
+void fill_voronoi_mesh(voronoi_mesh_t& mesh,
+                       DBlock*         dblock,
+                       bool            normals,
+                       int             num_threads,
+                       int             first_site,
+                       int             last_site)
+{
+    if (dblock->stars.offsets.empty())
+        fill_vert_stars(dblock->stars, dblock->tets, dblock->num_tets, dblock->num_particles);
+    update_spheres(dblock);
+    if (dblock->mirrors.empty())
+        fill_mirrors(dblock->mirrors, dblock->tets, dblock->num_tets, num_threads);
+    if (!dblock->complete_cells)
+        fill_complete_cells(dblock);
+
+    if (last_site < 0 || last_site > dblock->num_orig_particles)
+        last_site = dblock->num_orig_particles;
+    std::vector<int> sites;
+    for (int p = first_site; p < last_site; ++p)
+        if (CELL_COMPLETE(dblock, p))
+            sites.push_back(p);
+
+    fill_voronoi_mesh(mesh, sites, dblock->tets, dblock->stars, dblock->spheres, dblock->particles,
+                      normals, num_threads, dblock->num_tets ? &dblock->mirrors[0] : NULL);
+}
+//
+// fills the volumes, and optionally the surface areas and centroids, of the Voronoi cells of
+// the original particles of a block (-1 for incomplete cells); see fill_volumes() in volume.cpp
+//
+void fill_volumes(DBlock* dblock,
+                  float*  volumes,
+                  float*  areas,
+                  float*  centroids,
+                  int     num_threads)
+{
+    if (dblock->stars.offsets.empty())
+        fill_vert_stars(dblock->stars, dblock->tets, dblock->num_tets, dblock->num_particles);
+    if (dblock->mirrors.empty())
+        fill_mirrors(dblock->mirrors, dblock->tets, dblock->num_tets, num_threads);
+    update_spheres(dblock);
+
+    fill_volumes(volumes, areas, centroids, dblock->tets, dblock->stars, dblock->spheres,
+                 dblock->particles, dblock->num_orig_particles, num_threads,
+                 dblock->num_tets ? &dblock->mirrors[0] : NULL);
+}
+//
 // starts / stops timing
 // (does a barrier on comm)
 //
@@ -3,6 +3,7 @@
 #include <cstdio>
 
 #include <set>
+#include <algorithm>
 #include <queue>
 
 #include "tess/tet.hpp"
@@ -65,6 +66,129 @@ void circumcenter(float* center, tet_t* tet, float* particles)
         center[i] = d[i] + (norm_t*uv[i] + norm_u*vt[i] + norm_v*tu[i])/den;
 }
 
+// number of tets gathered into one batch of circumsphere_batch()
+#define TET_BATCH 64
+
+/**
+ * computes the circumspheres of a batch of n <= TET_BATCH tets
+ *
+ * The vertices are gathered into structure of arrays form first, so that the
+ * arithmetic, the same as in circumcenter(), runs as one vectorizable loop
+ * (AVX2/AVX-512 when the compiler targets them, scalar otherwise).
+ *
+ * spheres:	output, already sized to hold the tets
+ * ts:		indices of the tets, or NULL for the tets first, first + 1, ...
+ */
+static void circumsphere_batch(circumspheres_t& spheres,
+                               tet_t* tets,
+                               const int* ts,
+                               int first,
+                               int n,
+                               float* particles)
+{
+    float tx[TET_BATCH], ty[TET_BATCH], tz[TET_BATCH];  // a - d
+    float ux[TET_BATCH], uy[TET_BATCH], uz[TET_BATCH];  // b - d
+    float vx[TET_BATCH], vy[TET_BATCH], vz[TET_BATCH];  // c - d
+    float dx[TET_BATCH], dy[TET_BATCH], dz[TET_BATCH];  // d
+    float cx[TET_BATCH], cy[TET_BATCH], cz[TET_BATCH], cr[TET_BATCH];
+
+    // gather
+    for (int i = 0; i < n; ++i)
+    {
+        const tet_t& tet = tets[ts ? ts[i] : first + i];
+        float *a = &particles[3*tet.verts[0]],
+            *b = &particles[3*tet.verts[1]],
+            *c = &particles[3*tet.verts[2]],
+            *d = &particles[3*tet.verts[3]];
+        dx[i] = d[0];        dy[i] = d[1];        dz[i] = d[2];
+        tx[i] = a[0] - d[0]; ty[i] = a[1] - d[1]; tz[i] = a[2] - d[2];
+        ux[i] = b[0] - d[0]; uy[i] = b[1] - d[1]; uz[i] = b[2] - d[2];
+        vx[i] = c[0] - d[0]; vy[i] = c[1] - d[1]; vz[i] = c[2] - d[2];
+    }
+
+    // compute
+#pragma omp simd
+    for (int i = 0; i < n; ++i)
+    {
+        float norm_t = tx[i]*tx[i] + ty[i]*ty[i] + tz[i]*tz[i],
+            norm_u = ux[i]*ux[i] + uy[i]*uy[i] + uz[i]*uz[i],
+            norm_v = vx[i]*vx[i] + vy[i]*vy[i] + vz[i]*vz[i];
+
+        // u x v, v x t, t x u
+        float uvx = uy[i]*vz[i] - uz[i]*vy[i],
+            uvy = uz[i]*vx[i] - ux[i]*vz[i],
+            uvz = ux[i]*vy[i] - uy[i]*vx[i];
+        float vtx = vy[i]*tz[i] - vz[i]*ty[i],
+            vty = vz[i]*tx[i] - vx[i]*tz[i],
+            vtz = vx[i]*ty[i] - vy[i]*tx[i];
+        float tux = ty[i]*uz[i] - tz[i]*uy[i],
+            tuy = tz[i]*ux[i] - tx[i]*uz[i],
+            tuz = tx[i]*uy[i] - ty[i]*ux[i];
+
+        // 2 * determinant(t,u,v); nearly flat tets blow up, as in circumcenter()
+        float den = 2*(tx[i]*uvx + ty[i]*uvy + tz[i]*uvz);
+
+        // center relative to d
+        float ox = (norm_t*uvx + norm_u*vtx + norm_v*tux)/den,
+            oy = (norm_t*uvy + norm_u*vty + norm_v*tuy)/den,
+            oz = (norm_t*uvz + norm_u*vtz + norm_v*tuz)/den;
+
+        cx[i] = dx[i] + ox;
+        cy[i] = dy[i] + oy;
+        cz[i] = dz[i] + oz;
+
+        // radius is the distance to a
+        float rx = ox - tx[i], ry = oy - ty[i], rz = oz - tz[i];
+        cr[i] = sqrtf(rx*rx + ry*ry + rz*rz);
+    }
+
+    // scatter
+    for (int i = 0; i < n; ++i)
+    {
+        int t = ts ? ts[i] : first + i;
+        spheres.x[t] = cx[i];
+        spheres.y[t] = cy[i];
+        spheres.z[t] = cz[i];
+        spheres.r[t] = cr[i];
+    }
+}
+
+/**
+ * computes the circumspheres of all the tets
+ */
+void fill_circumspheres(circumspheres_t& spheres, tet_t* tets, int num_tets, float* particles)
+{
+    spheres.x.resize(num_tets);
+    spheres.y.resize(num_tets);
+    spheres.z.resize(num_tets);
+    spheres.r.resize(num_tets);
+
+    for (int t = 0; t < num_tets; t += TET_BATCH)
+        circumsphere_batch(spheres, tets, NULL, t, std::min(TET_BATCH, num_tets - t), particles);
+}
+
+/**
+ * recomputes the circumspheres of the changed tets; the other tets keep theirs
+ *
+ * num_tets:	number of tets after the change (spheres is resized to it)
+ * changed:	indices of the created or modified tets
+ */
+void update_circumspheres(circumspheres_t& spheres,
+                          tet_t* tets,
+                          int num_tets,
+                          const int* changed,
+                          int num_changed,
+                          float* particles)
+{
+    spheres.x.resize(num_tets);
+    spheres.y.resize(num_tets);
+    spheres.z.resize(num_tets);
+    spheres.r.resize(num_tets);
+
+    for (int i = 0; i < num_changed; i += TET_BATCH)
+        circumsphere_batch(spheres, tets, changed + i, 0, std::min(TET_BATCH, num_changed - i), particles);
+}
+
 // determine if any point in the box [min, max] lies on the opposite side of the
 // facet opposite to vertex j
 int side_of_plane(diy::ContinuousBounds box,
@@ -214,6 +338,40 @@ void circulate_next(int* next_t, int* next_v, tet_t* tets, int t, int v, int x,
     assert(false);	// must have found everything
 }
 
+/**
+ * circulate_next() using the mirror faces of the tets (see fill_mirrors()): the face we enter
+ * the next tetrahedron through is known, so the next vertex is the one of that face not on
+ * the edge, and nothing is searched in the current tetrahedron
+ *
+ * next_t:  will store the index of the next tetrahedron, -1 on the convex hull
+ * next_v:  will store the index of the next vertex
+ * tets:    array of all tetrahedra
+ * mirrors: mirror faces of the tets
+ * t:	    index into tets (current tetrahedron)
+ * v:	    index of the current vertex in tets->verts
+ * x,y:	    edge we are circulating around
+ */
+void circulate_next(int* next_t, int* next_v, tet_t* tets, const unsigned char* mirrors,
+                    int t, int v, int x, int y)
+{
+    *next_t = tets[t].tets[v];
+    if (*next_t == -1)
+        return;
+
+    int m = MIRROR(mirrors, t, v);
+    const tet_t* next = tets + *next_t;
+    for (int i = 0; i < 4; ++i) {
+        int inv = next->verts[i];
+        if (i   != m &&
+            inv != x &&
+            inv != y) {
+            *next_v = i;
+            return;
+        }
+    }
+    assert(false);	// must have found everything
+}
+
 /**
  * fills a vector of u, ut pairs with Delaunay neighbors and tetratehedra
  * that conain edge (v,u)
@@ -385,12 +543,14 @@ int complete(int	    v,
  * v,u:		    vertices
  * ut:		    a tet that contains edge (v,u)
  * tets:	    array of tets
+ * mirrors:	    optional mirror faces of the tets (see fill_mirrors())
  */
 void fill_edge_link(std::vector<int>&	edge_link,
 		    int			v,
 		    int			u,
 		    int			ut,
-		    tet_t*		tets)
+		    tet_t*		tets,
+		    const unsigned char* mirrors)
 {
     int wi = circulate_start(tets, ut, v, u);
     int t  = ut;
@@ -399,7 +559,10 @@ void fill_edge_link(std::vector<int>&	edge_link,
         edge_link.push_back(t);
 
         int next_t, next_wi;
-        circulate_next(&next_t, &next_wi, tets, t, wi, v, u);
+        if (mirrors)
+            circulate_next(&next_t, &next_wi, tets, mirrors, t, wi, v, u);
+        else
+            circulate_next(&next_t, &next_wi, tets, t, wi, v, u);
         if (next_t == ut || next_t == -1)
             break;
 
@@ -407,3 +570,223 @@ void fill_edge_link(std::vector<int>&	edge_link,
         wi = next_wi;
     }
 }
+
+/**
+ * finds the mirror face of every face of the tets, one byte per tet (see MIRROR())
+ *
+ * mirrors:	output, indexed by tet
+ * tets:	array of all tetrahedra
+ * num_tets:	number of tetrahedra
+ * num_threads:	threads filling the mirrors
+ */
+void fill_mirrors(std::vector<unsigned char>&	mirrors,
+                  tet_t*			tets,
+                  int				num_tets,
+                  int				num_threads)
+{
+    mirrors.resize(num_tets);
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+#endif
+    for (int t = 0; t < num_tets; ++t)
+    {
+        unsigned char m = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            int n = tets[t].tets[i];
+            if (n == -1)
+                continue;
+            for (int j = 0; j < 4; ++j)
+                if (tets[n].tets[j] == t)
+                {
+                    m |= j << (2 * i);
+                    break;
+                }
+        }
+        mirrors[t] = m;
+    }
+}
+
+/**
+ * builds the stars of all vertices in one pass over the tets
+ *
+ * stars:	output index
+ * tets:	array of all tetrahedra
+ * num_tets:	number of tetrahedra
+ * num_verts:	number of vertices
+ */
+void fill_vert_stars(vert_stars_t&	stars,
+                     tet_t*		tets,
+                     int		num_tets,
+                     int		num_verts)
+{
+    stars.offsets.assign(num_verts + 1, 0);
+    for (int t = 0; t < num_tets; ++t)
+        for (int i = 0; i < 4; ++i)
+            ++stars.offsets[tets[t].verts[i] + 1];
+    for (int v = 0; v < num_verts; ++v)
+        stars.offsets[v + 1] += stars.offsets[v];
+
+    std::vector<int> pos(stars.offsets.begin(), stars.offsets.end() - 1);
+    stars.tets.resize(4 * num_tets);
+    for (int t = 0; t < num_tets; ++t)
+        for (int i = 0; i < 4; ++i)
+            stars.tets[pos[tets[t].verts[i]]++] = t;
+}
+
+/**
+ * neighbor_edges() using the stars of the vertices
+ * (the neighbors come in the order of the star, not in BFS order)
+ */
+bool neighbor_edges(std::vector< std::pair<int, int> >& nbrs,
+                    int			v,
+                    tet_t*		tets,
+                    const vert_stars_t&	stars)
+{
+    bool   finite = true;
+    size_t first  = nbrs.size();
+
+    for (int k = stars.offsets[v]; k < stars.offsets[v + 1]; ++k)
+    {
+        int t = stars.tets[k];
+        for (int i = 0; i < 4; ++i) {
+            int u = tets[t].verts[i];
+            if (u == v)
+                continue;
+            if (tets[t].tets[i] == -1)
+                finite = false;
+
+            // stars are small, a linear search beats a set
+            size_t j = first;
+            while (j < nbrs.size() && nbrs[j].first != u)
+                ++j;
+            if (j == nbrs.size())
+                nbrs.push_back(std::make_pair(u,t));
+        }
+    }
+
+    return finite;
+}
+
+/**
+ * neighbor_tets() using the stars of the vertices
+ */
+bool neighbor_tets(std::vector<int>&	nbrs,
+                   int			v,
+                   tet_t*		tets,
+                   const vert_stars_t&	stars)
+{
+    nbrs.insert(nbrs.end(),
+                stars.tets.begin() + stars.offsets[v],
+                stars.tets.begin() + stars.offsets[v + 1]);
+    return complete(v, tets, stars);
+}
+
+/**
+ * complete() using the stars of the vertices; a vertex in no tet has no cell and is not
+ * complete
+ */
+int complete(int		v,
+             tet_t*		tets,
+             const vert_stars_t& stars)
+{
+    if (stars.offsets[v] == stars.offsets[v + 1])
+        return 0;
+
+    for (int k = stars.offsets[v]; k < stars.offsets[v + 1]; ++k)
+    {
+        int t = stars.tets[k];
+        for (int i = 0; i < 4; ++i)
+            if (tets[t].verts[i] != v && tets[t].tets[i] == -1)
+                return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * whether t is the smallest of the tets around edge (verts[x], verts[y]) of tets[t];
+ * walks around the edge in both directions when the edge is on the convex hull
+ */
+static bool owns_edge(tet_t* tets, int t, int x, int y)
+{
+    int ex = tets[t].verts[x], ey = tets[t].verts[y];
+    int other[2], k = 0;
+    for (int i = 0; i < 4; ++i)
+        if (i != x && i != y)
+            other[k++] = tets[t].verts[i];
+
+    for (int dir = 0; dir < 2; ++dir)
+    {
+        // cross the face opposite opp, which contains the edge and the remaining vertex
+        int cur = t;
+        int opp = other[dir];
+        while (true)
+        {
+            int next = tets[cur].tets[find(&tets[cur], opp)];
+            if (next == t)
+                return true;        // closed ring, all the tets seen
+            if (next == -1)
+                break;              // convex hull, walk the other way
+            if (next < t)
+                return false;
+
+            // in next, go on across the face opposite the vertex shared with cur
+            int i;
+            for (i = 0; i < 4; ++i)
+            {
+                int u = tets[cur].verts[i];
+                if (u != ex && u != ey && u != opp)
+                    break;
+            }
+            opp = tets[cur].verts[i];
+            cur = next;
+        }
+    }
+    return true;
+}
+
+/**
+ * enumerates every Delaunay edge once in a single pass over the tets: the edge
+ * is emitted by the smallest tet around it, so no set of seen edges is needed
+ *
+ * edges:	output pairs (u,v), u < v, in the order of their tets
+ * tets:	array of all tetrahedra
+ * num_tets:	number of tetrahedra
+ * num_threads:	threads sharing the tets
+ */
+void fill_edges(std::vector<int>&	edges,
+                tet_t*			tets,
+                int			num_tets,
+                int			num_threads)
+{
+    static const int tet_edges[6][2] = { {0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3} };
+
+    if (num_threads < 1 || num_tets < num_threads)
+        num_threads = 1;
+
+    // each thread fills the edges of a contiguous range of the tets
+    std::vector< std::vector<int> > parts(num_threads);
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+    for (int p = 0; p < num_threads; ++p)
+    {
+        int first = (long)num_tets * p / num_threads;
+        int last  = (long)num_tets * (p + 1) / num_threads;
+        for (int t = first; t < last; ++t)
+            for (int e = 0; e < 6; ++e)
+            {
+                int x = tet_edges[e][0], y = tet_edges[e][1];
+                if (!owns_edge(tets, t, x, y))
+                    continue;
+                int u = tets[t].verts[x], v = tets[t].verts[y];
+                parts[p].push_back(std::min(u, v));
+                parts[p].push_back(std::max(u, v));
+            }
+    }
+
+    edges.clear();
+    for (int p = 0; p < num_threads; ++p)
+        edges.insert(edges.end(), parts[p].begin(), parts[p].end());
+}
@@ -1,16 +1,11 @@
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include "tess/volume.h"
 #include "tess/tet-neighbors.h"
 
-void fill_circumcenters(std::vector<float>& circumcenters, tet_t* tets, int num_tets, float* particles)
-{
-  circumcenters.resize(num_tets*3);
-  for (int i = 0; i < num_tets; ++i)
-    circumcenter(&circumcenters[3*i], &tets[i], particles);
-}
-
-float volume(int v, int* verts_to_tets, tet_t* tets, int num_tets, float* particles, const std::vector<float>& circumcenters)
+float volume(int v, int* verts_to_tets, tet_t* tets, int num_tets, float* particles, const circumspheres_t& spheres)
 {
   int vt = verts_to_tets[v];
 
@@ -20,6 +15,23 @@ float volume(int v, int* verts_to_tets, tet_t* tets, int num_tets, float* partic
   if (!finite)
     return -1;	    // don't compute infinite volumes
 
+  return volume(v, nbrs, tets, particles, spheres);
+}
+
+float volume(int v, const vert_stars_t& stars, tet_t* tets, float* particles, const circumspheres_t& spheres)
+{
+  std::vector< std::pair<int, int> >	nbrs;
+  bool finite = neighbor_edges(nbrs, v, tets, stars);
+
+  if (!finite)
+    return -1;	    // don't compute infinite volumes
+
+  return volume(v, nbrs, tets, particles, spheres);
+}
+
+// volume of the (finite) Voronoi cell of v with Delaunay neighbors nbrs
+float volume(int v, const std::vector< std::pair<int, int> >& nbrs, tet_t* tets, float* particles, const circumspheres_t& spheres)
+{
   float vol = 0;
   for (int i = 0; i < nbrs.size(); ++i)
   {
@@ -35,11 +47,8 @@ float volume(int v, int* verts_to_tets, tet_t* tets, int num_tets, float* partic
       int b = edge_link[i];
       int c = edge_link[i+1];
 
-      float ab[3], ac[3];
-      for (int j = 0; j < 3; ++j) {
-	ab[j] = circumcenters[3*b + j] - circumcenters[3*a + j];
-	ac[j] = circumcenters[3*c + j] - circumcenters[3*a + j];
-      }
+      float ab[3] = { spheres.x[b] - spheres.x[a], spheres.y[b] - spheres.y[a], spheres.z[b] - spheres.z[a] };
+      float ac[3] = { spheres.x[c] - spheres.x[a], spheres.y[c] - spheres.y[a], spheres.z[c] - spheres.z[a] };
       float cp[3];
       cross(cp, ab, ac);
       area += sqrt(norm(cp))/2;
@@ -52,3 +61,234 @@ float volume(int v, int* verts_to_tets, tet_t* tets, int num_tets, float* partic
 
   return vol;
 }
+
+// volume of a cell of a Voronoi mesh
+float volume(const voronoi_mesh_t& mesh, int cell, const circumspheres_t& spheres, float* particles)
+{
+  int v = mesh.sites[cell];
+  float vol = 0;
+  for (int f = mesh.cell_faces[cell]; f < mesh.cell_faces[cell + 1]; ++f)
+  {
+    // area of the face
+    float area = 0;
+    int a = mesh.verts[mesh.face_verts[f]];
+    for (int i = mesh.face_verts[f] + 1; i < mesh.face_verts[f + 1] - 1; ++i) {
+      int b = mesh.verts[i];
+      int c = mesh.verts[i + 1];
+
+      float ab[3] = { spheres.x[b] - spheres.x[a], spheres.y[b] - spheres.y[a], spheres.z[b] - spheres.z[a] };
+      float ac[3] = { spheres.x[c] - spheres.x[a], spheres.y[c] - spheres.y[a], spheres.z[c] - spheres.z[a] };
+      float cp[3];
+      cross(cp, ab, ac);
+      area += sqrt(norm(cp))/2;
+    }
+
+    // distance between the sites on the two sides of the face
+    float dist = distance(&particles[3*mesh.face_sites[f]], &particles[3*v]);
+    vol += area*dist/6;
+  }
+
+  return vol;
+}
+
+// whether the facet of edge (v,u) is computed, from v: each edge once, from its smaller
+// vertex, and only if it bounds a complete cell
+static inline bool facet_needed(int v, int u, const std::vector<unsigned char>& finite,
+                                int num_particles)
+{
+  if (u < v)
+    return false;
+  return finite[v] || (u < num_particles && finite[u]);
+}
+
+/**
+ * computes the volumes, and optionally the surface areas and centroids, of the Voronoi
+ * cells of particles 0, ..., num_particles - 1 in one pass over the Delaunay edges:
+ * the facet dual to edge (u,v) is computed once and adds a pyramid to both cells;
+ * each cell sums its facets in the order of its star, so the results do not depend
+ * on the number of threads
+ *
+ * volumes:	output, num_particles volumes (-1 for incomplete cells), or NULL
+ * areas:	output, num_particles surface areas (-1 for incomplete cells), or NULL
+ * centroids:	output, 3 * num_particles coordinates (x,y,z), or NULL
+ * tets:	array of all tetrahedra
+ * stars:	stars of the vertices (see fill_vert_stars())
+ * spheres:	circumspheres of the tets (see fill_circumspheres())
+ * particles:	array of particles (x1,y1,z1,x2,y2,z2,...)
+ * num_particles: number of cells, the particles after them (ghosts) get no cells
+ * num_threads:	threads sharing the edges
+ */
+void fill_volumes(float*                  volumes,
+                  float*                  areas,
+                  float*                  centroids,
+                  tet_t*                  tets,
+                  const vert_stars_t&     stars,
+                  const circumspheres_t&  spheres,
+                  float*                  particles,
+                  int                     num_particles,
+                  int                     num_threads,
+                  const unsigned char*    mirrors)
+{
+  // centroids need the volumes to be normalized
+  std::vector<float> vols;
+  if (!volumes && centroids)
+  {
+    vols.resize(num_particles);
+    volumes = &vols[0];
+  }
+
+  if (volumes)
+    memset(volumes, 0, num_particles * sizeof(float));
+  if (areas)
+    memset(areas, 0, num_particles * sizeof(float));
+  if (centroids)
+    memset(centroids, 0, 3 * num_particles * sizeof(float));
+
+  // the edges of complete cells go around closed links; only those are circulated
+  std::vector<unsigned char> finite(num_particles);
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+  for (int v = 0; v < num_particles; ++v)
+    finite[v] = complete(v, tets, stars);
+
+  // the edges (v,u), u > v, whose facets are needed, in CSR form in the order of the star
+  // of v: counted first, then filled in place
+  std::vector<size_t> edge_offsets(num_particles + 1, 0);
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+    std::vector< std::pair<int, int> > nbrs;
+
+#ifndef TESS_NO_OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+    for (int v = 0; v < num_particles; ++v)
+    {
+      nbrs.clear();
+      neighbor_edges(nbrs, v, tets, stars);
+      size_t num = 0;
+      for (size_t i = 0; i < nbrs.size(); ++i)
+        if (facet_needed(v, nbrs[i].first, finite, num_particles))
+          num++;
+      edge_offsets[v + 1] = num;
+    }
+  }
+  for (int v = 0; v < num_particles; ++v)
+    edge_offsets[v + 1] += edge_offsets[v];
+  size_t num_edges = edge_offsets[num_particles];
+
+  // other end, area, pyramid volume, and area-weighted centroid of the facet of each edge
+  std::vector<int>   edge_ends(num_edges);
+  std::vector<float> edge_areas(num_edges);
+  std::vector<float> edge_vols(num_edges);
+  std::vector<float> edge_centroids(centroids ? 3 * num_edges : 0);
+
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+    std::vector< std::pair<int, int> > nbrs;
+    std::vector<int> edge_link;
+
+#ifndef TESS_NO_OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+    for (int v = 0; v < num_particles; ++v)
+    {
+      nbrs.clear();
+      neighbor_edges(nbrs, v, tets, stars);
+      size_t e = edge_offsets[v];
+      for (size_t i = 0; i < nbrs.size(); ++i)
+      {
+        int u = nbrs[i].first;
+        if (!facet_needed(v, u, finite, num_particles))
+          continue;
+
+        edge_link.clear();
+        fill_edge_link(edge_link, v, u, nbrs[i].second, tets, mirrors);
+
+        // area and centroid of the facet, as a fan of triangles
+        float area = 0;
+        float fc[3] = { 0, 0, 0 };
+        int a = edge_link[0];
+        float pa[3] = { spheres.x[a], spheres.y[a], spheres.z[a] };
+        for (size_t k = 1; k + 1 < edge_link.size(); ++k)
+        {
+          int b = edge_link[k];
+          int c = edge_link[k + 1];
+          float pb[3] = { spheres.x[b], spheres.y[b], spheres.z[b] };
+          float pc[3] = { spheres.x[c], spheres.y[c], spheres.z[c] };
+          float ab[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+          float ac[3] = { pc[0] - pa[0], pc[1] - pa[1], pc[2] - pa[2] };
+          float cp[3];
+          cross(cp, ab, ac);
+          float tri = sqrt(norm(cp))/2;
+          area += tri;
+          for (int j = 0; j < 3; ++j)
+            fc[j] += tri * (pa[j] + pb[j] + pc[j]) / 3;
+        }
+
+        // the facet bisects the edge, so both pyramids have height |uv| / 2
+        edge_ends[e] = u;
+        edge_areas[e] = area;
+        edge_vols[e] = area * distance(&particles[3*u], &particles[3*v]) / 6;
+        if (centroids)
+          for (int j = 0; j < 3; ++j)
+            edge_centroids[3*e + j] = fc[j];
+        e++;
+      }
+    }
+
+    // each cell sums its facets in the order of its star, found in the edges of the
+    // smaller vertex
+#ifndef TESS_NO_OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+    for (int w = 0; w < num_particles; ++w)
+    {
+      nbrs.clear();
+      neighbor_edges(nbrs, w, tets, stars);
+      for (size_t i = 0; i < nbrs.size(); ++i)
+      {
+        int u = nbrs[i].first;
+        int v = std::min(u, w), x = std::max(u, w);
+        size_t e = edge_offsets[v];
+        while (e < edge_offsets[v + 1] && edge_ends[e] != x)
+          ++e;
+        if (e == edge_offsets[v + 1])
+          continue;
+
+        float area = edge_areas[e];
+        float pyramid = edge_vols[e];
+        if (volumes)
+          volumes[w] += pyramid;
+        if (areas)
+          areas[w] += area;
+        if (centroids && area > 0)
+          // centroid of the pyramid is 3/4 of the way from the apex to the facet centroid
+          for (int j = 0; j < 3; ++j)
+            centroids[3*w + j] += pyramid * (particles[3*w + j] + 3 * edge_centroids[3*e + j] / area) / 4;
+      }
+    }
+  }
+
+  for (int v = 0; v < num_particles; ++v)
+  {
+    if (!finite[v])
+    {
+      if (volumes)
+        volumes[v] = -1;
+      if (areas)
+        areas[v] = -1;
+      if (centroids)
+        for (int j = 0; j < 3; ++j)
+          centroids[3*v + j] = particles[3*v + j];
+      continue;
+    }
+    if (centroids)
+      for (int j = 0; j < 3; ++j)
+        centroids[3*v + j] = volumes[v] > 0 ? centroids[3*v + j] / volumes[v] : particles[3*v + j];
+  }
+}
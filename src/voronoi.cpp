@@ -0,0 +1,134 @@
+#include <cmath>
+
+#include "tess/voronoi.h"
+
+// fills mesh with the cells of sites[first], ..., sites[last - 1]; an infinite
+// cell gets no faces
+static void fill_cells(voronoi_mesh_t&          mesh,
+                       const std::vector<int>&  sites,
+                       int                      first,
+                       int                      last,
+                       tet_t*                   tets,
+                       const vert_stars_t&      stars,
+                       const circumspheres_t&   spheres,
+                       float*                   particles,
+                       bool                     normals,
+                       const unsigned char*     mirrors)
+{
+  std::vector< std::pair<int, int> > nbrs;
+  std::vector<int> edge_link;
+
+  mesh = voronoi_mesh_t();
+  mesh.cell_faces.push_back(0);
+  mesh.face_verts.push_back(0);
+  for (int c = first; c < last; ++c)
+  {
+    int v = sites[c];
+    mesh.sites.push_back(v);
+
+    nbrs.clear();
+    if (neighbor_edges(nbrs, v, tets, stars))
+      for (int i = 0; i < (int)nbrs.size(); ++i)
+      {
+        // the face dual to the edge (v,u) goes around the edge
+        int u = nbrs[i].first;
+        edge_link.clear();
+        fill_edge_link(edge_link, v, u, nbrs[i].second, tets, mirrors);
+
+        mesh.face_sites.push_back(u);
+        mesh.verts.insert(mesh.verts.end(), edge_link.begin(), edge_link.end());
+        mesh.face_verts.push_back((int)mesh.verts.size());
+
+        if (!normals)
+          continue;
+
+        // Newell's method, oriented away from the site
+        float n[3] = { 0, 0, 0 };
+        int nv = (int)edge_link.size();
+        for (int j = 0; j < nv; ++j)
+        {
+          int cur  = edge_link[j];
+          int next = edge_link[(j + 1) % nv];
+          n[0] += (spheres.y[cur] - spheres.y[next]) * (spheres.z[cur] + spheres.z[next]);
+          n[1] += (spheres.z[cur] - spheres.z[next]) * (spheres.x[cur] + spheres.x[next]);
+          n[2] += (spheres.x[cur] - spheres.x[next]) * (spheres.y[cur] + spheres.y[next]);
+        }
+        float mag = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        int a = edge_link[0];
+        float d = (spheres.x[a] - particles[3 * v])     * n[0] +
+                  (spheres.y[a] - particles[3 * v + 1]) * n[1] +
+                  (spheres.z[a] - particles[3 * v + 2]) * n[2];
+        if (d < 0)
+          mag = -mag;
+        for (int j = 0; j < 3; ++j)
+          mesh.normals.push_back(n[j] / mag);
+      }
+    mesh.cell_faces.push_back(mesh.num_faces());
+  }
+}
+
+// appends part to mesh, shifting the offsets of part
+static void append_cells(voronoi_mesh_t& mesh, const voronoi_mesh_t& part)
+{
+  int faces = mesh.num_faces();
+  int verts = (int)mesh.verts.size();
+
+  mesh.sites.insert(mesh.sites.end(), part.sites.begin(), part.sites.end());
+  for (size_t i = 1; i < part.cell_faces.size(); ++i)
+    mesh.cell_faces.push_back(faces + part.cell_faces[i]);
+  mesh.face_sites.insert(mesh.face_sites.end(), part.face_sites.begin(), part.face_sites.end());
+  for (size_t i = 1; i < part.face_verts.size(); ++i)
+    mesh.face_verts.push_back(verts + part.face_verts[i]);
+  mesh.verts.insert(mesh.verts.end(), part.verts.begin(), part.verts.end());
+  mesh.normals.insert(mesh.normals.end(), part.normals.begin(), part.normals.end());
+}
+
+/**
+ * builds the Voronoi cells of the given sites in one pass, in parallel over the cells
+ *
+ * mesh:	output; cell c is the cell of sites[c]
+ * sites:	the sites (particles) whose cells to build; their cells should be complete,
+ *		an infinite cell is left without faces
+ * tets:	array of all tetrahedra
+ * stars:	stars of the vertices (see fill_vert_stars())
+ * spheres:	circumspheres of the tets (see fill_circumspheres())
+ * particles:	array of particles (x1,y1,z1,x2,y2,z2,...)
+ * normals:	whether to compute the outward unit normals of the faces
+ * num_threads:	threads building the cells
+ * mirrors:	optional mirror faces of the tets (see fill_mirrors())
+ */
+void fill_voronoi_mesh(voronoi_mesh_t&          mesh,
+                       const std::vector<int>&  sites,
+                       tet_t*                   tets,
+                       const vert_stars_t&      stars,
+                       const circumspheres_t&   spheres,
+                       float*                   particles,
+                       bool                     normals,
+                       int                      num_threads,
+                       const unsigned char*     mirrors)
+{
+  int num_cells = (int)sites.size();
+  if (num_threads < 1 || num_cells < num_threads)
+    num_threads = 1;
+  if (num_threads == 1)
+  {
+    fill_cells(mesh, sites, 0, num_cells, tets, stars, spheres, particles, normals, mirrors);
+    return;
+  }
+
+  // each thread builds a contiguous range of the cells
+  std::vector<voronoi_mesh_t> parts(num_threads);
+#ifndef TESS_NO_OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+  for (int i = 0; i < num_threads; ++i)
+    fill_cells(parts[i], sites,
+               (long)num_cells * i / num_threads, (long)num_cells * (i + 1) / num_threads,
+               tets, stars, spheres, particles, normals, mirrors);
+
+  mesh = voronoi_mesh_t();
+  mesh.cell_faces.push_back(0);
+  mesh.face_verts.push_back(0);
+  for (int i = 0; i < num_threads; ++i)
+    append_cells(mesh, parts[i]);
+}
@@ -1098,14 +1098,18 @@ void PrepCellVertRendering() {
 
     for (int b = 0; b < nblocks; b++) { // blocks
 
+        update_spheres(master->block<DBlock>(b));
+        const circumspheres_t& spheres = master->block<DBlock>(b)->spheres;
+
         // tets
         for (int t = 0; t < master->block<DBlock>(b)->num_tets; t++) {
 
             // push voronoi vertex for rendering
             // voronoi vertex is the circumcenter of the tet
             vec3d center;
-            circumcenter(&center.x,
-                         &(master->block<DBlock>(b)->tets[t]), master->block<DBlock>(b)->particles);
+            center.x = spheres.x[t];
+            center.y = spheres.y[t];
+            center.z = spheres.z[t];
 
 #if 0	// debug purpuses only
             const tet_t& tt = master->block<DBlock>(b)->tets[t];
@@ -1131,61 +1135,50 @@ void PrepCellVertRendering() {
 //
 void PrepCellRendering(stats_t& stats) {
 
-    int v0 = 0; // starting vertex of the current face
     stats.tot_cells = 0; // number of visible cells
     stats.tot_cell_vol = 0.0; // total cell volume
 
     for (int b = 0; b < nblocks; b++) { // blocks
 
-        vector<float> circumcenters;
-        fill_circumcenters(circumcenters, master->block<DBlock>(b)->tets, master->block<DBlock>(b)->num_tets, master->block<DBlock>(b)->particles);
+        // complete voronoi cells, with face normals
+        voronoi_mesh_t mesh;
+        fill_voronoi_mesh(mesh, master->block<DBlock>(b), true);
+        const circumspheres_t& spheres = master->block<DBlock>(b)->spheres;
+
+        // volumes of all the cells
+        vector<float> cell_vols(master->block<DBlock>(b)->num_orig_particles);
+        if (!cell_vols.empty())
+            fill_volumes(master->block<DBlock>(b), &cell_vols[0]);
 
         // for all voronoi cells
-        for (int p = 0; p < master->block<DBlock>(b)->num_orig_particles; p++) {
+        for (int c = 0; c < mesh.num_cells(); c++) {
 
             // tet
+            int p = mesh.sites[c];
             int t = master->block<DBlock>(b)->vert_to_tet[p];
 
             // skip tets with missing neighbors
-            if (t == -1 ||
-                master->block<DBlock>(b)->tets[t].tets[0] == -1 ||
+            if (master->block<DBlock>(b)->tets[t].tets[0] == -1 ||
                 master->block<DBlock>(b)->tets[t].tets[1] == -1 ||
                 master->block<DBlock>(b)->tets[t].tets[2] == -1 ||
                 master->block<DBlock>(b)->tets[t].tets[3] == -1)
                 continue;
 
-            // neighbor edges a vector of (vertex u, tet of vertex u) pairs
-            // that neighbor vertex v
-            vector< pair<int, int> > nbrs;
-            bool finite = neighbor_edges(nbrs, p, master->block<DBlock>(b)->tets, t);
-
-            // skip tet vertices corresponding to incomplete voronoi cells
-            if (!finite)
-                continue;
-
             bool keep = true; // this cell passes all tests, volume, data extents
             vector <vec3d> temp_verts; // verts in this cell
             vector <int> temp_num_face_verts;  // number of face verts in this call
             vector <vec3d> temp_vor_normals; // face normals in this cell
 
-            // the following loop is the equivalent of
             // for all faces in a voronoi cell
-            for (int i = 0; i < (int)nbrs.size(); ++i) {
-
-                v0 = (int)temp_verts.size(); // note starting vertex of this face
-
-                // get edge link
-                int u  = nbrs[i].first;
-                int ut = nbrs[i].second;
-                std::vector<int> edge_link;
-                fill_edge_link(edge_link, p, u, ut, master->block<DBlock>(b)->tets);
+            for (int f = mesh.cell_faces[c]; f < mesh.cell_faces[c + 1]; ++f) {
 
                 // following is equivalent of all vertices in a face
-                for (int j = 0; j < (int)edge_link.size(); ++j) {
+                for (int j = mesh.face_verts[f]; j < mesh.face_verts[f + 1]; ++j) {
 
                     vec3d center;
-                    circumcenter((float *)&(center.x),
-                                 &(master->block<DBlock>(b)->tets[edge_link[j]]), master->block<DBlock>(b)->particles);
+                    center.x = spheres.x[mesh.verts[j]];
+                    center.y = spheres.y[mesh.verts[j]];
+                    center.z = spheres.z[mesh.verts[j]];
 
                     // filter out cells far outside the overal extents
                     if (center.x > data_max.x + (data_max.x - data_min.x) * (ds - 1) ||
@@ -1200,24 +1193,13 @@ void PrepCellRendering(stats_t& stats) {
 
                 }
 
-                temp_num_face_verts.push_back(edge_link.size());
+                temp_num_face_verts.push_back(mesh.face_verts[f + 1] - mesh.face_verts[f]);
 
-                // face normal (flat shading, one normal per face)
+                // face normal (flat shading, one normal per face), outward
                 vec3d normal;
-                NewellNormal(&temp_verts[v0], edge_link.size(), normal);
-
-                // check sign of dot product of normal with vector from site
-                // to first face vertex to see if normal has correct direction
-                // want outward normal
-                vec3d vec;
-                vec.x = temp_verts[v0].x - sites[p].x;
-                vec.y = temp_verts[v0].y - sites[p].y;
-                vec.z = temp_verts[v0].z - sites[p].z;
-                if (vec.x * normal.x + vec.y * normal.y + vec.z * normal.z < 0.0) {
-                    normal.x *= -1.0;
-                    normal.y *= -1.0;
-                    normal.z *= -1.0;
-                }
+                normal.x = mesh.normals[3 * f];
+                normal.y = mesh.normals[3 * f + 1];
+                normal.z = mesh.normals[3 * f + 2];
                 temp_vor_normals.push_back(normal);
 
             } // for all faces in a voronoi cell
@@ -1232,8 +1214,7 @@ void PrepCellRendering(stats_t& stats) {
                 for (int k = 0; k < (int)temp_vor_normals.size(); k++)
                     vor_normals.push_back(temp_vor_normals[k]);
                 stats.tot_cells++;
-                vols.push_back(volume(p, master->block<DBlock>(b)->vert_to_tet, master->block<DBlock>(b)->tets, master->block<DBlock>(b)->num_tets,
-                                      master->block<DBlock>(b)->particles, circumcenters));
+                vols.push_back(cell_vols[p]);
                 if (vols.size() == 1 || vols.back() < stats.min_cell_vol)
                     stats.min_cell_vol = vols.back();
                 if (vols.size() == 1 || vols.back() > stats.max_cell_vol)
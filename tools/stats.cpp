@@ -12,16 +12,12 @@ void print_block_info(void* b_, const diy::Master::ProxyWithLink& cp)
 
 void sum_edges(void* b_, const diy::Master::ProxyWithLink& cp)
 {
-  dblock_t* b = static_cast<dblock_t*>(b_);
+  DBlock* b = static_cast<DBlock*>(b_);
 
-  std::vector< std::pair<int, int> > nbrs;
-  size_t total_edges = 0;
-  for (size_t v = 0; v < b->num_orig_particles; ++v)
-  {
-    neighbor_edges(nbrs, v, b->tets, b->vert_to_tet[v]);
-    total_edges += nbrs.size();
-    nbrs.clear();
-  }
+  // every edge once across the blocks
+  std::vector<int> edges;
+  fill_edges(edges, b);
+  size_t total_edges = edges.size() / 2;
 
   cp.all_reduce(total_edges, std::plus<size_t>());
   size_t nparticles = b->num_orig_particles;